@@ -26,208 +26,74 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 // Compute shaders are part of openGL core since version 4.3
 #version 430
 
-// This will just run once for each particle.
-layout(local_size_x = 1, local_size_y = 1, local_size_z = 1) in;
-
-#define MAX_MESHES 10
-#define MAX_TRIANGLES_PER_MESH 1486 // biggest mesh is 1486 triangles
-#define NUM_TRIANGLES_IN_SCENE 4462 // This is calculated in the console window
-#define MAX_TRIANGLES_PER_CHUNK 400
-
-struct triangle 
-{
-	vec4 pos[3];
-	vec4 uv[3];
-	vec4 normal[3];
-	vec4 color;
-};
-
-struct chunk
+// This runs once for each instance that moved since the last frame
+// (each entry of dirtyInstances.dirty), 64 of them in each work group.
+// With one instance per group, a big scene needs one group for every
+// instance, and most of the GPU's lanes sit idle in each one. 64 is a
+// whole number of warps (32) and wavefronts (64), so no lanes are wasted
+// in a full group. main.cpp reads this size from the program, and
+// dispatches enough groups to cover numDirty instances. The last group
+// can have some invocations left over, which return right away
+layout(local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
+
+// One copy of a mesh in the world, see Scene.h.
+// The triangles and BVH of the mesh never move, the fragment
+// shader moves its rays into object space with worldToObject.
+// Only the matrices are written here, the C++ code fills the
+// rest of every instance once, when the buffer is made
+struct instance
 {
-	vec4 min;
-	vec4 max;
-
-	int numTrianglesInThisChunk;
-	int junk1;
-	int junk2;
-	int junk3;
-	triangle collision[12];
-
-	int triangleIndices[MAX_TRIANGLES_PER_CHUNK];
-};
+	mat4x4 objectToWorld;
+	mat4x4 worldToObject;
 
-struct Mesh
-{
-	vec4 min;
-	vec4 max;
-
-	int numTriangles;
-	int optimizationLevel; // 1 for single box, 2 for octants
+	int mesh;
+	int texture;
 	int boolUseEffects;
 	int reflectionLevel;
-	triangle collision[12];
-	
-	chunk c[8];
-	triangle t[MAX_TRIANGLES_PER_MESH];
+
+	vec2 uvScale;
+	int junk[2];
 };
 
-// A layout describing the vertex buffer.
-layout(binding = 0) buffer b0
+layout(std430, binding = 0) buffer b0
 {
-	Mesh m[MAX_MESHES];
-} outBuffer;
+	instance i[];
+} outInstances;
 
-layout (binding = 1) buffer b1
+// Only the instances that moved since the last frame are transformed,
+// the rest keep the matrices that they already have in outInstances.
+// Invocation k gives instance dirty[k] the matrix m[k]
+layout (std430, binding = 1) buffer b1
 {
-	Mesh m[MAX_MESHES];
-} inGeometry;
+	int dirty[];
+} dirtyInstances;
 
 layout (binding = 2) buffer b2
 {
-	mat4x4 m[MAX_MESHES];
+	mat4x4 m[];
 } inMatrices;
 
+// How many instances moved. The buffers are bound to just the
+// matrices and indices of this frame, but the last work group
+// can still have more invocations than that
+uniform uint numDirty;
+
 // Declare main program function which is executed when
 void main()
 {
-	// Get the index of this object into the buffer
-	uint i = gl_GlobalInvocationID.x;
-
-	int meshIndex = 0;
-	uint count = i;
-
-
-	// Geometry
-	// --------------------------
-
-	// count is the triangle index of the mesh
-	// that is being processed
-
-	while(count >= inGeometry.m[meshIndex].numTriangles)
-	{
-		count -= inGeometry.m[meshIndex].numTriangles;
-		meshIndex++;
-
-		if(meshIndex == MAX_MESHES) break;
-	}
-
-	if(meshIndex < MAX_MESHES)
-	{
-		for(int j = 0; j < 3; j++)
-		{
-			// multiply point by model matrix, and then export to fragment shader buffer
-			vec4 point = inMatrices.m[meshIndex] * inGeometry.m[meshIndex].t[count].pos[j];
-			outBuffer.m[meshIndex].t[count].pos[j] = point;
-
-			// multiply point by model matrix, and then export to fragment shader buffer
-			vec3 normal = mat3(inMatrices.m[meshIndex]) * inGeometry.m[meshIndex].t[count].normal[j].xyz;
-			outBuffer.m[meshIndex].t[count].normal[j] = vec4(normalize(normal), 1);
-		}
-
-		// The color of each mesh, the UV coordinates, and the number of
-		// triangles per mesh, are already in the output buffer. An 
-		// explanation of how this is possible is written in the main.cpp
-		// file in the init() function
+	uint k = gl_GlobalInvocationID.x;
 
+	if(k >= numDirty)
 		return;
-	}
-
-	// Lev1 mesh boxes
-	// ----------------------------------------------
 
+	// Get the index of this instance
+	int i = dirtyInstances.dirty[k];
 
-	// We have determined that this compute instance is not 
-	// handling mesh geometry, so it must be handling the
-	// collision boxes
+	// The triangles, normals, and BVH boxes are not touched,
+	// so this work does not grow with the number of triangles,
+	// and instances of the same mesh don't repeat any work
+	mat4x4 model = inMatrices.m[k];
 
-	// reset mesh index array
-	meshIndex = 0;
-
-	// get the first mesh with a hitbox
-	while(inGeometry.m[meshIndex].optimizationLevel == 0)
-	{
-		meshIndex++;
-	}
-
-	// 12 triangles for each mesh's hitbox
-	while(count >= 12)
-	{
-		// If this mesh has a collision box
-		if(inGeometry.m[meshIndex].optimizationLevel > 0)
-		{
-			count -= 12;
-		}
-
-		meshIndex++;
-
-		if(meshIndex == MAX_MESHES) break;
-	}
-
-	if(meshIndex < MAX_MESHES)
-	{
-		for(int j = 0; j < 3; j++)
-		{
-			// multiply point by model matrix, and then export to fragment shader buffer
-			vec4 point = inMatrices.m[meshIndex] * inGeometry.m[meshIndex].collision[count].pos[j];
-			outBuffer.m[meshIndex].collision[count].pos[j] = point;
-		}
-
-		return;
-	}
-
-	// Lev2 division boxes
-	// ----------------------------------------------
-
-	// At this point, it must be doing octants
-
-	// reset mesh index array
-	meshIndex = 0;
-
-	// get the first mesh with a hitbox
-	while(inGeometry.m[meshIndex].optimizationLevel < 2)
-	{
-		meshIndex++;
-	}
-
-	// 12 triangles for each mesh's hitbox
-	while(count >= 8*12)
-	{
-		// If this mesh has a collision box
-		if(inGeometry.m[meshIndex].optimizationLevel == 2)
-		{
-			count -= 8*12;
-		}
-
-		meshIndex++;
-
-		if(meshIndex == MAX_MESHES) break;
-	}
-
-	meshIndex--;
-
-	if(meshIndex < MAX_MESHES)
-	{
-		int boxIndex = 0;
-
-		// 12 triangles for each mesh's hitbox
-		while(count >= 12)
-		{
-			count -= 12;
-			boxIndex++;
-
-			if(boxIndex == 8) break;
-		}
-
-		if(boxIndex < 8)
-		{
-			for(int j = 0; j < 3; j++)
-			{
-				// multiply point by model matrix, and then export to fragment shader buffer
-				vec4 point = inMatrices.m[meshIndex] * inGeometry.m[meshIndex].c[boxIndex].collision[count].pos[j];
-				outBuffer.m[meshIndex].c[boxIndex].collision[count].pos[j] = point;
-			}
-		}
-	}
-
-	// In theory, we'll never be here
-}
\ No newline at end of file
+	outInstances.i[i].objectToWorld = model;
+	outInstances.i[i].worldToObject = inverse(model);
+}
@@ -51,69 +51,229 @@ struct light
 // Create some constants
 #define MAX_SCENE_BOUNDS 100.0
 
-#define MAX_LIGHTS 5
-#define MAX_MESHES 10
-#define MAX_TRIANGLES_PER_MESH 1486 // biggest mesh is 1486 triangles
-#define NUM_TRIANGLES_IN_SCENE 4462 // This is calculated in the console window
-#define MAX_TRIANGLES_PER_CHUNK 400
-
+#define BVH_STACK_SIZE 32
 
+// Only the triangles and the positions of their points are read
+// while searching for the closest triangle. xyz of faceNormal is
+// the face normal, and v has the three points, in the vertex pool,
+// counted from the first vertex of the mesh
 struct triangle 
 {
-	vec4 pos[3];
-	vec4 uv[3];
-	vec4 normal[3];
-	vec4 color;
+	vec4 faceNormal;
+	int v[3];
+	int color;	// with QUANTIZED_ATTRIBUTES, the index of the color in the palette
 };
 
-struct chunk
+// main.cpp adds "#define QUANTIZED_ATTRIBUTES" after the #version line
+// with --quantize. Then the UVs and normals are packed into 8 bytes
+// instead of 32, and the colors are in a palette, see Quantize.h
+#ifdef QUANTIZED_ATTRIBUTES
+
+// Only read for the points of the triangle that the ray hits.
+// The normal is octahedral, as two 16 bit numbers, and the
+// UV is two half floats
+struct vertexAttributes
 {
-	vec4 min;
-	vec4 max;
+	uint normal;
+	uint uv;
+};
 
-	int numTrianglesInThisChunk;
-	int junk1;
-	int junk2;
-	int junk3;
-	triangle collision[12];
+#else
 
-	int triangleIndices[MAX_TRIANGLES_PER_CHUNK];
+// Only read for the triangle that the ray hits
+struct triangleAttributes
+{
+	vec4 color;
 };
 
-struct Mesh
+// Only read for the points of the triangle that the ray hits
+struct vertexAttributes
+{
+	vec4 normal;
+	vec4 uv;
+};
+
+#endif
+
+// One box of the BVH of a mesh, see Bvh.cpp
+struct bvhNode
 {
 	vec4 min;
 	vec4 max;
 
+	int firstChild;		// inner node: left child, the right child is next
+	int firstTriangle;	// leaf node: first triangle
+	int numTriangles;	// 0 for inner nodes
+	int junk;
+};
+
+struct Mesh
+{
 	int numTriangles;
-	int optimizationLevel; // 1 for single box, 2 for octants
+	int firstTriangle;
+	int numNodes;
+	int firstNode;
+	int numVertices;
+	int firstVertex;
+};
+
+// One copy of a mesh in the world. Compute.glsl writes the
+// matrices, the rest is set once by main.cpp. Many instances
+// can use the same mesh, which is only in the pools once
+struct instance
+{
+	mat4x4 objectToWorld;
+	mat4x4 worldToObject;
+
+	int mesh;
+	int texture;	// the layer of textures that it uses
 	int boolUseEffects;
 	int reflectionLevel;
-	triangle collision[12];
-	
-	chunk c[8];
-	triangle t[MAX_TRIANGLES_PER_MESH];
+
+	vec2 uvScale;	// how much of the layer one copy of its texture covers
+	int junk[2];
 };
 
-// texture that we will use
-uniform sampler2D textureTest[MAX_MESHES];
+// Every texture in the scene, one in each layer. This is one sampler,
+// so the number of textures is not limited by the texture units.
+// A texture that is smaller than the layers is repeated over
+// its whole layer, see LoadTexture in main.cpp
+uniform sampler2DArray textures;
+
+// The arrays in the storage buffers below have no size here,
+// they are as long as the buffers that main.cpp gives them
 
 // A layout describing the vertex buffer.
-layout(binding = 0) buffer vertexBlock
+// The meshes only say where their triangles and nodes
+// are, the triangles themselves are in the triangle pool
+layout(std430, binding = 0) buffer meshBlock
 {
-	Mesh m[MAX_MESHES];
+	Mesh m[];
 };
 
 layout (binding = 1) buffer lightBlock
 {
-	light lights[MAX_LIGHTS];
+	light lights[];
+};
+
+// Every triangle in the scene, one mesh after another.
+// The triangles, attributes, and nodes are in object space
+layout(std430, binding = 2) buffer triangleBlock
+{
+	triangle triangles[];
+};
+
+// The BVH nodes of every mesh, one mesh after another
+layout(std430, binding = 3) buffer nodeBlock
+{
+	bvhNode nodes[];
+};
+
+#ifdef QUANTIZED_ATTRIBUTES
+
+// Every color in the scene once, each triangle has its index
+layout(std430, binding = 4) buffer attributeBlock
+{
+	vec4 palette[];
+};
+
+#else
+
+// The color of every triangle, with the same index as the triangle
+layout(std430, binding = 4) buffer attributeBlock
+{
+	triangleAttributes attributes[];
 };
 
+#endif
+
+// Every instance, with its matrices for this frame
+layout(std430, binding = 5) buffer instanceBlock
+{
+	instance instances[];
+};
+
+// The top level BVH, over the boxes of the instances in the world.
+// Its leaves have a range of tlasInstances, which has the instance
+// index of each item. main.cpp builds it again every frame, and
+// numTlasNodes says how many nodes it has this frame
+uniform int numTlasNodes;
+
+layout(std430, binding = 6) buffer tlasNodeBlock
+{
+	bvhNode tlasNodes[];
+};
+
+layout(std430, binding = 7) buffer tlasInstanceBlock
+{
+	int tlasInstances[];
+};
+
+// The position of every point of every mesh, one mesh after
+// another. A point is shared by every triangle that uses it
+layout(std430, binding = 8) buffer vertexBlock
+{
+	vec4 vertices[];
+};
+
+// The UVs and normals of every point, with the same index as the position
+layout(std430, binding = 9) buffer vertexAttributeBlock
+{
+	vertexAttributes vertexAttribs[];
+};
+
+// The normal, UV, and color of a point or triangle, unpacked
+// if they are packed. v is in the vertex pool, t is in the
+// triangle pool
+#ifdef QUANTIZED_ATTRIBUTES
+
+vec3 getVertexNormal(int v)
+{
+	// Unfold the octahedron, see Quantize.cpp
+	vec2 p = unpackSnorm2x16(vertexAttribs[v].normal);
+	vec3 n = vec3(p, 1.0 - abs(p.x) - abs(p.y));
+
+	if(n.z < 0)
+		n.xy = (1.0 - abs(n.yx)) * vec2(p.x >= 0 ? 1.0 : -1.0, p.y >= 0 ? 1.0 : -1.0);
+
+	return normalize(n);
+}
+
+vec2 getVertexUV(int v)
+{
+	return unpackHalf2x16(vertexAttribs[v].uv);
+}
+
+vec4 getTriangleColor(int t)
+{
+	return palette[triangles[t].color];
+}
+
+#else
+
+vec3 getVertexNormal(int v)
+{
+	return vertexAttribs[v].normal.xyz;
+}
+
+vec2 getVertexUV(int v)
+{
+	return vertexAttribs[v].uv.xy;
+}
+
+vec4 getTriangleColor(int t)
+{
+	return attributes[t].color;
+}
+
+#endif
+
 struct hitinfo
 {
 	vec3 point;
-	int m;
-	int t;
+	vec3 objectPoint; // point, in the object space of the mesh
+	int m; // index of the instance
+	int t; // index of the triangle in the triangle pool
 };
 
 // Determines whether or not a ray in a given direction hits a given triangle.
@@ -181,44 +341,169 @@ float rayIntersectsTriangle(vec3 p, vec3 d, vec3 v0, vec3 v1, vec3 v2)
 	return -1.0;
 }
 
-bool intersectMeshBox(vec3 origin, vec3 dir, int meshIndex)
+// Determines whether or not a ray hits a box, with the slab test. The box is
+// the space between two planes on each axis, and the ray is inside the box
+// between the last plane it crosses going in, and the first plane it crosses
+// going out. invDir is 1 / dir, so each plane only costs a multiply.
+// Returns -1.0 if the ray misses, otherwise the distance where the ray enters
+// the box, which is 0 if the ray starts inside of it
+float intersectBox(vec3 origin, vec3 invDir, vec4 boxMin, vec4 boxMax)
 {
-	for(int i = 0; i < 12; i++)
+	// distance to both planes on each axis
+	vec3 t0 = (boxMin.xyz - origin) * invDir;
+	vec3 t1 = (boxMax.xyz - origin) * invDir;
+
+	// which plane is crossed first depends on the direction of the ray
+	vec3 tNear = min(t0, t1);
+	vec3 tFar = max(t0, t1);
+
+	float enter = max(max(tNear.x, tNear.y), max(tNear.z, 0.0));
+	float exit = min(min(tFar.x, tFar.y), tFar.z);
+
+	// the ray leaves through one side before it enters through another
+	if(enter > exit)
 	{
-		// Compute distance d using above function to determine how far along the ray the triangle collides.
-		float d = rayIntersectsTriangle(origin, dir, 
-			m[meshIndex].collision[i].pos[0].xyz, 
-			m[meshIndex].collision[i].pos[1].xyz,
-			m[meshIndex].collision[i].pos[2].xyz);
-
-		// If t = -1.0 then there was no intersection
-		if(d != -1.0)
-		{
-			return true;
-		}
+		return -1.0;
 	}
 
-	return false;
+	return enter;
 }
 
-bool intersectChunkBox(vec3 origin, vec3 dir, int meshIndex, int chunkIndex)
+// Tests a ray against the BVH of the mesh of instance i. The ray is moved into
+// the object space of the mesh, so the triangles and boxes never need to be moved.
+// smallest is in world units, and info is only changed for a closer hit
+bool intersectMesh(int i, vec3 origin, vec3 dir, inout float smallest, inout hitinfo info)
 {
-	for(int i = 0; i < 12; i++)
+	bool found = false;
+	float d = -1.0f;
+	int mesh = instances[i].mesh;
+
+	// The direction is normalized again, so the triangle test works the
+	// same for every mesh, and scale turns object distances into world distances
+	mat4x4 worldToObject = instances[i].worldToObject;
+	vec3 objOrigin = (worldToObject * vec4(origin, 1)).xyz;
+	vec3 objDir = mat3(worldToObject) * dir;
+	float scale = 1.0 / length(objDir);
+	objDir *= scale;
+	vec3 objInvDir = 1.0 / objDir;
+
+	// Skip the mesh if the ray misses its box, or if
+	// a closer triangle was already found in another mesh
+	int root = m[mesh].firstNode;
+	float rootDist = intersectBox(objOrigin, objInvDir, nodes[root].min, nodes[root].max);
+
+	if(rootDist == -1.0 || rootDist * scale >= smallest)
+		return false;
+
+	// The nodes that this ray still needs to visit, and
+	// how far away the ray enters each of their boxes
+	int stack[BVH_STACK_SIZE];
+	float stackDist[BVH_STACK_SIZE];
+
+	// Start at the root of the mesh's BVH
+	int stackSize = 0;
+	stack[stackSize] = root;
+	stackDist[stackSize++] = rootDist;
+
+	while(stackSize > 0)
 	{
-		// Compute distance d using above function to determine how far along the ray the triangle collides.
-		float d = rayIntersectsTriangle(origin, dir, 
-			m[meshIndex].c[chunkIndex].collision[i].pos[0].xyz, 
-			m[meshIndex].c[chunkIndex].collision[i].pos[1].xyz,
-			m[meshIndex].c[chunkIndex].collision[i].pos[2].xyz);
-
-		// If t = -1.0 then there was no intersection
-		if(d != -1.0)
+		stackSize--;
+		int nodeIndex = stack[stackSize];
+
+		// A closer triangle was found after this box was
+		// added to the stack, so nothing inside it can be closer
+		if(stackDist[stackSize] * scale >= smallest)
+			continue;
+
+		int numTriangles = nodes[nodeIndex].numTriangles;
+
+		// Inner node, test the boxes of both children. The closer
+		// child is visited first, because the triangles it finds
+		// can let us skip the other child
+		if(numTriangles == 0)
+		{
+			int left = root + nodes[nodeIndex].firstChild;
+			int right = left + 1;
+
+			float leftDist = intersectBox(objOrigin, objInvDir, nodes[left].min, nodes[left].max);
+			float rightDist = intersectBox(objOrigin, objInvDir, nodes[right].min, nodes[right].max);
+
+			bool hitLeft = leftDist != -1.0 && leftDist * scale < smallest;
+			bool hitRight = rightDist != -1.0 && rightDist * scale < smallest;
+
+			if(hitLeft && hitRight)
+			{
+				// the farther child goes on the stack first
+				if(leftDist < rightDist)
+				{
+					stack[stackSize] = right;
+					stackDist[stackSize++] = rightDist;
+					stack[stackSize] = left;
+					stackDist[stackSize++] = leftDist;
+				}
+				else
+				{
+					stack[stackSize] = left;
+					stackDist[stackSize++] = leftDist;
+					stack[stackSize] = right;
+					stackDist[stackSize++] = rightDist;
+				}
+			}
+			else if(hitLeft)
+			{
+				stack[stackSize] = left;
+				stackDist[stackSize++] = leftDist;
+			}
+			else if(hitRight)
+			{
+				stack[stackSize] = right;
+				stackDist[stackSize++] = rightDist;
+			}
+
+			continue;
+		}
+
+		// Leaf node, check all triangles in the leaf
+		int firstTriangle = m[mesh].firstTriangle + nodes[nodeIndex].firstTriangle;
+		int firstVertex = m[mesh].firstVertex;
+
+		for(int j = 0; j < numTriangles; j++)
 		{
-			return true;
+			int triangleIndex = firstTriangle + j;
+			triangle t = triangles[triangleIndex];
+
+			// Optimization to see if the polygon is facing
+			// a direction that the ray can hit
+			
+			if(dot(t.faceNormal.xyz, objDir) > 0)
+				continue;
+
+			// Compute distance d using above function to determine how far along the ray the triangle collides.
+			d = rayIntersectsTriangle(objOrigin, objDir,
+				vertices[firstVertex + t.v[0]].xyz,
+				vertices[firstVertex + t.v[1]].xyz,
+				vertices[firstVertex + t.v[2]].xyz);
+
+			// If t = -1.0 then there was no intersection, we also ignore it if t is not < smallest, as that would mean we already found a triangle that 
+			// was closer (and thus collides first).
+			if(d != -1.0 && d * scale < smallest)
+			{
+				// This t becomes the new smallest.
+				smallest = d * scale;
+
+				// color can be found via index as can the normal
+				// Thus, we just pass out a point of collision using t and the triangle index.
+				info.objectPoint = objOrigin + (objDir * d);
+				info.m = i;
+				info.t = triangleIndex;
+
+				// Make sure we set found to true, signifying that the ray collided with something.
+				found = true;
+			}
 		}
 	}
 
-	return false;
+	return found;
 }
 
 // Given an origin point, a direction, and a variable to pass information back out to, this will test a ray against every triangle in the scene.
@@ -231,124 +516,95 @@ bool intersectTriangles(vec3 origin, vec3 dir, out hitinfo info)
 	// Found just determines whether or not there was a collision at all.
 	float smallest = MAX_SCENE_BOUNDS;
 	bool found = false;
-	float d = -1.0f;
 
-	for(int i = 0; i < MAX_MESHES; i++)
+	// Nothing is in the world
+	if(numTlasNodes == 0)
+		return false;
+
+	vec3 invDir = 1.0 / dir;
+
+	float rootDist = intersectBox(origin, invDir, tlasNodes[0].min, tlasNodes[0].max);
+
+	if(rootDist == -1.0)
+		return false;
+
+	// The top level nodes that this ray still needs to visit,
+	// the same way that intersectMesh visits the nodes of a mesh
+	int stack[BVH_STACK_SIZE];
+	float stackDist[BVH_STACK_SIZE];
+
+	// Start at the root of the top level BVH
+	int stackSize = 0;
+	stack[stackSize] = 0;
+	stackDist[stackSize++] = rootDist;
+
+	while(stackSize > 0)
 	{
-		// This is level 1 optimization, where it checks
-		// the box around the entire mesh, but does NOT
-		// check the dividing 8 boxes, which would be oct-tree
-		
-		bool checkMesh = false;
+		stackSize--;
+		int nodeIndex = stack[stackSize];
 
-		// If this mesh has no meshBox,
-		// due to being low-poly anyways
-		if(m[i].optimizationLevel == 0)
-		{
-			checkMesh = true;
-		}
+		if(stackDist[stackSize] >= smallest)
+			continue;
 
-		// If this is a high poly model
-		else
-		{
-			checkMesh = intersectMeshBox(origin, dir, i);
-		}
+		int numInstances = tlasNodes[nodeIndex].numTriangles;
 
-		// If this ray intersected the mesh's box
-		if(checkMesh)
+		// Inner node, visit the closer child first
+		if(numInstances == 0)
 		{
-			int triangleIndex;
+			int left = tlasNodes[nodeIndex].firstChild;
+			int right = left + 1;
+
+			float leftDist = intersectBox(origin, invDir, tlasNodes[left].min, tlasNodes[left].max);
+			float rightDist = intersectBox(origin, invDir, tlasNodes[right].min, tlasNodes[right].max);
+
+			bool hitLeft = leftDist != -1.0 && leftDist < smallest;
+			bool hitRight = rightDist != -1.0 && rightDist < smallest;
 
-			if(m[i].optimizationLevel == 2)
+			if(hitLeft && hitRight)
 			{
-				for(int boxID = 0; boxID < 8; boxID++)
+				if(leftDist < rightDist)
 				{
-					bool checkBox = intersectChunkBox(origin, dir, i, boxID);
-
-					if(checkBox)
-					{
-						// check all triangles in the mesh
-						for(int j = 0; j < m[i].c[boxID].numTrianglesInThisChunk; j++)
-						{
-							triangleIndex = m[i].c[boxID].triangleIndices[j];
-							triangle t = m[i].t[triangleIndex];
-
-							// Optimization to see if the polygon is facing
-							// a direction that the ray can hit
-							
-							if(
-								(dot(t.normal[0].xyz, dir) > 0) &&
-								(dot(t.normal[1].xyz, dir) > 0) &&
-								(dot(t.normal[2].xyz, dir) > 0)
-							)
-								continue;
-
-							// Compute distance d using above function to determine how far along the ray the triangle collides.
-							d = rayIntersectsTriangle(origin, dir, t.pos[0].xyz, t.pos[1].xyz, t.pos[2].xyz);
-						
-							// If t = -1.0 then there was no intersection, we also ignore it if t is not < smallest, as that would mean we already found a triangle that 
-							// was closer (and thus collides first).
-							if(d != -1.0 && d < smallest)
-							{
-								// This t becomes the new smallest.
-								smallest = d;
-
-								// color can be found via index as can the normal
-								// Thus, we just pass out a point of collision using t and the triangle index.
-								info.point = origin + (dir * d);
-								info.m = i;
-								info.t = triangleIndex;
-
-								// Make sure we set found to true, signifying that the ray collided with something.
-								found = true;
-							}
-						}
-					}
+					stack[stackSize] = right;
+					stackDist[stackSize++] = rightDist;
+					stack[stackSize] = left;
+					stackDist[stackSize++] = leftDist;
 				}
-			}
-
-			else
-			{
-				// check all triangles in the mesh
-				for(int j = 0; j < m[i].numTriangles; j++)
+				else
 				{
-					triangle t = m[i].t[j];
-					triangleIndex = j;
-
-					// Optimization to see if the polygon is facing
-					// a direction that the ray can hit
-					
-					if(
-						(dot(t.normal[0].xyz, dir) > 0) &&
-						(dot(t.normal[1].xyz, dir) > 0) &&
-						(dot(t.normal[2].xyz, dir) > 0)
-					)
-						continue;
-
-					// Compute distance d using above function to determine how far along the ray the triangle collides.
-					d = rayIntersectsTriangle(origin, dir, t.pos[0].xyz, t.pos[1].xyz, t.pos[2].xyz);
-
-					// If t = -1.0 then there was no intersection, we also ignore it if t is not < smallest, as that would mean we already found a triangle that 
-					// was closer (and thus collides first).
-					if(d != -1.0 && d < smallest)
-					{
-						// This t becomes the new smallest.
-						smallest = d;
-
-						// color can be found via index as can the normal
-						// Thus, we just pass out a point of collision using t and the triangle index.
-						info.point = origin + (dir * d);
-						info.m = i;
-						info.t = triangleIndex;
-
-						// Make sure we set found to true, signifying that the ray collided with something.
-						found = true;
-					}
+					stack[stackSize] = left;
+					stackDist[stackSize++] = leftDist;
+					stack[stackSize] = right;
+					stackDist[stackSize++] = rightDist;
 				}
 			}
+			else if(hitLeft)
+			{
+				stack[stackSize] = left;
+				stackDist[stackSize++] = leftDist;
+			}
+			else if(hitRight)
+			{
+				stack[stackSize] = right;
+				stackDist[stackSize++] = rightDist;
+			}
+
+			continue;
+		}
+
+		// Leaf node, check the BVH of every instance in the leaf
+		int firstInstance = tlasNodes[nodeIndex].firstTriangle;
+
+		for(int j = 0; j < numInstances; j++)
+		{
+			if(intersectMesh(tlasInstances[firstInstance + j], origin, dir, smallest, info))
+				found = true;
 		}
 	}
 
+	// the point of collision, in world space
+	if(found)
+		info.point = origin + (dir * smallest);
+
 	return found;
 }
 
@@ -433,21 +689,47 @@ vec2 GetInterpolatedUV(vec3 pointHit, vec3 p1, vec3 p2, vec3 p3, vec2 t1, vec2 t
 
 vec4 getSurfaceColor(hitinfo i)
 {
-	triangle t = m[i.m].t[i.t];
+	triangle t = triangles[i.t];
+	ivec3 v = ivec3(t.v[0], t.v[1], t.v[2]) + m[instances[i.m].mesh].firstVertex;
 
-	vec4 triangleColor = vec4(t.color.xyz, 1);
+	vec4 triangleColor = vec4(getTriangleColor(i.t).xyz, 1);
 
+	// the UVs are interpolated in object space, where the triangle is
 	vec2 uv = GetInterpolatedUV(
-		i.point,
-		t.pos[0].xyz,
-		t.pos[1].xyz,
-		t.pos[2].xyz,
-		vec2(t.uv[0]),
-		vec2(t.uv[1]),
-		vec2(t.uv[2])
+		i.objectPoint,
+		vertices[v.x].xyz,
+		vertices[v.y].xyz,
+		vertices[v.z].xyz,
+		getVertexUV(v.x),
+		getVertexUV(v.y),
+		getVertexUV(v.z)
 	);
 
-	return texture(textureTest[i.m], uv.xy) * triangleColor;
+	// A texture that is smaller than its layer is repeated over the
+	// layer, so the UV is scaled down to one copy of it
+	vec2 layerUV = uv.xy * instances[i.m].uvScale;
+
+	return texture(textures, vec3(layerUV, instances[i.m].texture)) * triangleColor;
+}
+
+// The interpolated normal of triangle t of instance instanceIndex at objectPoint.
+// The normals are in object space, so they are moved into world space
+// with the inverse transpose of the model matrix
+vec3 getWorldNormal(int instanceIndex, int t, vec3 objectPoint)
+{
+	triangle tri = triangles[t];
+	ivec3 v = ivec3(tri.v[0], tri.v[1], tri.v[2]) + m[instances[instanceIndex].mesh].firstVertex;
+
+	vec3 normal = GetInterpolatedNormal(
+		objectPoint, 
+		vertices[v.x].xyz,
+		vertices[v.y].xyz,
+		vertices[v.z].xyz,
+		getVertexNormal(v.x),
+		getVertexNormal(v.y),
+		getVertexNormal(v.z));
+
+	return normalize(transpose(mat3(instances[instanceIndex].worldToObject)) * normal);
 }
 
 vec3 addLightColorToPixColor(light L, vec3 dirRayToPoint, hitinfo rayHitPoint)
@@ -484,19 +766,9 @@ vec3 addLightColorToPixColor(light L, vec3 dirRayToPoint, hitinfo rayHitPoint)
 		}
 	}
 
-	hitinfo i = rayHitPoint;
-	triangle t = m[i.m].t[i.t];
-
 	// Get the interpolated normal for the Point that is hit on the triangle by the ray
 	// This normal will be interpolated between all three vertex normals
-	vec3 normal = GetInterpolatedNormal(
-		rayHitPoint.point, 
-		t.pos[0].xyz,
-		t.pos[1].xyz,
-		t.pos[2].xyz,
-		t.normal[0].xyz,
-		t.normal[1].xyz,
-		t.normal[2].xyz);
+	vec3 normal = getWorldNormal(rayHitPoint.m, rayHitPoint.t, rayHitPoint.objectPoint);
 
 	// Get a reflection vector bouncing the light ray off the surface of the triangle.
 	// Used for specular light calculations.
@@ -520,8 +792,8 @@ vec3 addLightColorToPixColor(light L, vec3 dirRayToPoint, hitinfo rayHitPoint)
 	// 0 by default, for objects that aren't reflective
 	float specular = 0.0f;
 	
-	// get reflectivity level from Mesh
-	int maxBounces = m[rayHitPoint.m].reflectionLevel;
+	// get reflectivity level from the instance
+	int maxBounces = instances[rayHitPoint.m].reflectionLevel;
 	
 	// if the object is reflective in any way
 	if(maxBounces != 0)
@@ -570,23 +842,15 @@ vec3 addReflectionToPixColor(light L, vec3 dir, hitinfo rayHitPoint, out bool en
 
 	hitinfo h = rayHitPoint;
 
-	// get reflectivity level from Mesh
-	int maxBounces = m[h.m].reflectionLevel;
+	// get reflectivity level from the instance
+	int maxBounces = instances[h.m].reflectionLevel;
 
 	for(int i = 0; i < maxBounces; i++)
 	{
-		triangle t = m[h.m].t[h.t];
-
 		// Get the interpolated normal for the Point that is hit on the triangle by the ray
 		// This normal will be interpolated between all three vertex normals
-		vec3 normal = GetInterpolatedNormal(
-			rayHitPoint.point, 
-			t.pos[0].xyz,
-			t.pos[1].xyz,
-			t.pos[2].xyz,
-			t.normal[0].xyz,
-			t.normal[1].xyz,
-			t.normal[2].xyz);
+		vec3 objectPoint = (instances[h.m].worldToObject * vec4(rayHitPoint.point, 1)).xyz;
+		vec3 normal = getWorldNormal(h.m, h.t, objectPoint);
 
 		// Gets a vector in the direction of the reflected ray.
 		reflectedRayToPoint = reflect(dir, normal);
@@ -596,7 +860,7 @@ vec3 addReflectionToPixColor(light L, vec3 dir, hitinfo rayHitPoint, out bool en
 		if(intersectTriangles(rayHitPoint.point, reflectedRayToPoint, reflectHit))
 		{
 			// If you are reflecting a surface that has no effects
-			if(m[reflectHit.m].boolUseEffects == 0)
+			if(instances[reflectHit.m].boolUseEffects == 0)
 			{
 				// dont calculate lighting, and dont 
 				// calculate more reflection bounces
@@ -612,7 +876,7 @@ vec3 addReflectionToPixColor(light L, vec3 dir, hitinfo rayHitPoint, out bool en
 			// This is the lighting that is in the geometry that is reflected off of other geomtry
 			color += addLightColorToPixColor(L, reflectedRayToPoint, reflectHit) * pow(0.5, i);
 
-			if(m[reflectHit.m].reflectionLevel == 0)
+			if(instances[reflectHit.m].reflectionLevel == 0)
 			{
 				break;
 			}
@@ -646,7 +910,7 @@ vec4 trace(vec3 origin, vec3 dirEyeToTriangle)
 		vec4 surfaceColor = getSurfaceColor(eyeHitTriangle);
 		
 		// If you dont want any effects on this object
-		if(m[eyeHitTriangle.m].boolUseEffects == 0)
+		if(instances[eyeHitTriangle.m].boolUseEffects == 0)
 		{
 			// return the color without reflection
 			return surfaceColor;
@@ -656,7 +920,7 @@ vec4 trace(vec3 origin, vec3 dirEyeToTriangle)
 		vec3 pixColor;
 		
 		// If you can reflect
-		if(m[eyeHitTriangle.m].reflectionLevel != 0)
+		if(instances[eyeHitTriangle.m].reflectionLevel != 0)
 		{
 			// set ambient occlusion low, and reflect skybox
 			pixColor = surfaceColor.xyz * 0.1;
@@ -671,11 +935,11 @@ vec4 trace(vec3 origin, vec3 dirEyeToTriangle)
 
 		bool endEarly;
 
-		// Loop through each light. By default, we have 4 lights.
-		// To use 4 lights, we have "j < MAX_LIGHTS" in our 'for' loop.
+		// Loop through each light. The buffer has every light in the scene,
+		// so we have "j < lights.length()" in our 'for' loop.
 		// If you want to use less lights, you can use "j < 1"
 		// or "j < 2", to reduce the amount of processing and boost FPS
-		for(int j = 0; j < MAX_LIGHTS; j++)
+		for(int j = 0; j < lights.length(); j++)
 		{
 			// color of reflected light
 			// This is a combination of the color of the polygon that the eye's ray hit,
@@ -685,7 +949,7 @@ vec4 trace(vec3 origin, vec3 dirEyeToTriangle)
 			
 			vec3 reflection = vec3(0);
 
-			if(!endEarly && m[eyeHitTriangle.m].reflectionLevel != 0)
+			if(!endEarly && instances[eyeHitTriangle.m].reflectionLevel != 0)
 			{
 				// color of reflections
 				// We get reflection level from the hitinfo
@@ -728,4 +992,4 @@ void main(void)
 	vec2 pos = textureCoord;
 	vec3 dir = normalize(mix(mix(ray00, ray01, pos.y), mix(ray10, ray11, pos.y), pos.x));
 	color = trace(eye, dir);
-}
\ No newline at end of file
+}
\ No newline at end of file
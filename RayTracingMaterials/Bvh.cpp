@@ -0,0 +1,476 @@
+/*
+Title: Basic Ray Tracer
+File Name: Bvh.cpp
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <algorithm>
+#include <cfloat>
+
+#include "Bvh.h"
+
+// A box that grows to fit everything that is added to it
+struct BvhBox
+{
+	glm::vec3 min = glm::vec3(FLT_MAX);
+	glm::vec3 max = glm::vec3(-FLT_MAX);
+
+	void grow(glm::vec3 p)
+	{
+		min = glm::min(min, p);
+		max = glm::max(max, p);
+	}
+
+	void grow(const BvhBox& b)
+	{
+		min = glm::min(min, b.min);
+		max = glm::max(max, b.max);
+	}
+
+	float area() const
+	{
+		glm::vec3 d = max - min;
+
+		// nothing has been added
+		if (d.x < 0)
+			return 0;
+
+		return 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+	}
+};
+
+// Everything we need while building the BVH of one mesh,
+// or the top level BVH over the meshes in the world
+struct BvhBuilder
+{
+	std::vector<BvhBox> boxes;			// box around each triangle (or mesh)
+	std::vector<glm::vec3> centers;		// center of each box
+	std::vector<int> order;				// triangles, sorted so each leaf's triangles are together
+	std::vector<bvhNode>* nodes;
+	int firstNode;						// first node of this mesh
+	float itemCost;						// SAH cost of testing one triangle (or mesh)
+	BvhStats* stats;
+};
+
+// Does the triangle touch the box? This is the separating axis test by
+// Tomas Akenine-Moller. The triangle and the box don't touch if there is
+// any axis where their shadows don't overlap, and there are only 13 axes
+// that need to be checked: the 3 box axes, the triangle normal, and the
+// cross product of every box axis with every triangle edge
+static bool TriangleOverlapsBox(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2, const BvhBox& box)
+{
+	glm::vec3 center = (box.min + box.max) * 0.5f;
+	glm::vec3 half = (box.max - box.min) * 0.5f;
+
+	// A tiny bit of room, so a triangle that lies
+	// on the side of its box is not lost to rounding
+	half += glm::vec3(1e-5f) * (1.0f + glm::max(glm::max(half.x, half.y), half.z));
+
+	// move everything so the box is at the origin
+	v0 -= center;
+	v1 -= center;
+	v2 -= center;
+
+	glm::vec3 edges[3] = { v1 - v0, v2 - v1, v0 - v2 };
+
+	// The 9 edge axes
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			glm::vec3 boxAxis = glm::vec3(0);
+			boxAxis[i] = 1;
+
+			glm::vec3 axis = glm::cross(boxAxis, edges[j]);
+
+			float p0 = glm::dot(v0, axis);
+			float p1 = glm::dot(v1, axis);
+			float p2 = glm::dot(v2, axis);
+			float r = glm::dot(half, glm::abs(axis));
+
+			if (glm::min(p0, glm::min(p1, p2)) > r || glm::max(p0, glm::max(p1, p2)) < -r)
+				return false;
+		}
+	}
+
+	// The 3 box axes, which is the same as testing the box around the triangle
+	glm::vec3 triMin = glm::min(v0, glm::min(v1, v2));
+	glm::vec3 triMax = glm::max(v0, glm::max(v1, v2));
+
+	for (int i = 0; i < 3; i++)
+	{
+		if (triMin[i] > half[i] || triMax[i] < -half[i])
+			return false;
+	}
+
+	// The triangle normal, where the box has to cross the plane of the triangle
+	glm::vec3 normal = glm::cross(edges[0], edges[1]);
+	float d = glm::dot(normal, v0);
+	float r = glm::dot(half, glm::abs(normal));
+
+	return glm::abs(d) <= r;
+}
+
+// Walks the finished BVH of a mesh, and counts the triangles that would
+// never be found by a ray: triangles that are in no leaf, in more than one
+// leaf, or that are not inside the box of their leaf
+static int CountLostTriangles(const Mesh* m, const triangle* t, const glm::vec4* v, const std::vector<bvhNode>& nodes)
+{
+	std::vector<int> leavesPerTriangle(m->numTriangles, 0);
+	int lost = 0;
+
+	for (int i = m->firstNode; i < m->firstNode + m->numNodes; i++)
+	{
+		const bvhNode& node = nodes[i];
+
+		if (node.numTriangles == 0)
+			continue;
+
+		BvhBox box;
+		box.min = glm::vec3(node.min);
+		box.max = glm::vec3(node.max);
+
+		for (int j = node.firstTriangle; j < node.firstTriangle + node.numTriangles; j++)
+		{
+			leavesPerTriangle[j]++;
+
+			if (!TriangleOverlapsBox(glm::vec3(v[t[j].v[0]]), glm::vec3(v[t[j].v[1]]), glm::vec3(v[t[j].v[2]]), box))
+				lost++;
+		}
+	}
+
+	for (int j = 0; j < m->numTriangles; j++)
+	{
+		if (leavesPerTriangle[j] != 1)
+			lost++;
+	}
+
+	return lost;
+}
+
+// Which bin the center of a triangle falls into, along one axis
+static int GetBin(float center, float min, float extent)
+{
+	int bin = (int)(SAH_NUM_BINS * (center - min) / extent);
+	return glm::clamp(bin, 0, SAH_NUM_BINS - 1);
+}
+
+static void MakeLeaf(BvhBuilder& b, int nodeIndex, int begin, int end, int depth)
+{
+	bvhNode& node = (*b.nodes)[b.firstNode + nodeIndex];
+	node.firstChild = 0;
+	node.firstTriangle = begin;
+	node.numTriangles = end - begin;
+
+	b.stats->numLeaves++;
+	b.stats->maxDepth = glm::max(b.stats->maxDepth, depth);
+	b.stats->maxTrianglesPerLeaf = glm::max(b.stats->maxTrianglesPerLeaf, end - begin);
+}
+
+// Builds the node for triangles order[begin] to order[end - 1], then its children
+static void BuildNode(BvhBuilder& b, int nodeIndex, int begin, int end, int depth)
+{
+	// Box around every triangle, and around every center
+	BvhBox box;
+	BvhBox centerBox;
+
+	for (int i = begin; i < end; i++)
+	{
+		box.grow(b.boxes[b.order[i]]);
+		centerBox.grow(b.centers[b.order[i]]);
+	}
+
+	bvhNode& node = (*b.nodes)[b.firstNode + nodeIndex];
+	node.min = glm::vec4(box.min, 1.0f);
+	node.max = glm::vec4(box.max, 1.0f);
+
+	int count = end - begin;
+
+	// The stack of the rays can't go deeper than this
+	if (count == 1 || depth == BVH_STACK_SIZE - 1)
+	{
+		MakeLeaf(b, nodeIndex, begin, end, depth);
+		return;
+	}
+
+	// Find the cheapest split, on the edge between two bins, on any axis.
+	// If no split is cheaper than testing every triangle, this is a leaf
+	float parentArea = box.area();
+	float bestCost = count * b.itemCost;
+	int bestAxis = -1;
+	int bestSplit = 0;
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float min = centerBox.min[axis];
+		float extent = centerBox.max[axis] - min;
+
+		// every center is in the same place on this axis
+		if (extent <= 0 || parentArea <= 0)
+			continue;
+
+		BvhBox binBox[SAH_NUM_BINS];
+		int binCount[SAH_NUM_BINS] = {};
+
+		for (int i = begin; i < end; i++)
+		{
+			int bin = GetBin(b.centers[b.order[i]][axis], min, extent);
+			binBox[bin].grow(b.boxes[b.order[i]]);
+			binCount[bin]++;
+		}
+
+		// Sweep from the left and from the right, so that leftArea[i]
+		// and leftCount[i] are for everything in bins 0 to i - 1, and
+		// rightArea[i] and rightCount[i] for everything in bins i and up
+		float leftArea[SAH_NUM_BINS];
+		float rightArea[SAH_NUM_BINS];
+		int leftCount[SAH_NUM_BINS];
+		int rightCount[SAH_NUM_BINS];
+
+		BvhBox left;
+		BvhBox right;
+		int numLeft = 0;
+		int numRight = 0;
+
+		for (int i = 1; i < SAH_NUM_BINS; i++)
+		{
+			left.grow(binBox[i - 1]);
+			numLeft += binCount[i - 1];
+			leftArea[i] = left.area();
+			leftCount[i] = numLeft;
+
+			right.grow(binBox[SAH_NUM_BINS - i]);
+			numRight += binCount[SAH_NUM_BINS - i];
+			rightArea[SAH_NUM_BINS - i] = right.area();
+			rightCount[SAH_NUM_BINS - i] = numRight;
+		}
+
+		for (int i = 1; i < SAH_NUM_BINS; i++)
+		{
+			if (leftCount[i] == 0 || rightCount[i] == 0)
+				continue;
+
+			float cost =
+				SAH_BOX_COST * (leftArea[i] + rightArea[i]) / parentArea +
+				b.itemCost * (leftArea[i] * leftCount[i] + rightArea[i] * rightCount[i]) / parentArea;
+
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = i;
+			}
+		}
+	}
+
+	int split;
+
+	if (bestAxis != -1)
+	{
+		// Move the triangles in the bins left of the split to the front
+		float min = centerBox.min[bestAxis];
+		float extent = centerBox.max[bestAxis] - min;
+
+		int* mid = std::partition(&b.order[begin], &b.order[begin] + count, [&](int t)
+		{
+			return GetBin(b.centers[t][bestAxis], min, extent) < bestSplit;
+		});
+
+		split = (int)(mid - &b.order[0]);
+	}
+	else if (count <= BVH_MAX_LEAF_TRIANGLES)
+	{
+		MakeLeaf(b, nodeIndex, begin, end, depth);
+		return;
+	}
+	else
+	{
+		// Too many triangles for one leaf, so split them in half, at
+		// the middle center along the longest axis. If every center is
+		// in the same place, this still splits the list in half
+		glm::vec3 size = centerBox.max - centerBox.min;
+		int axis = 0;
+
+		if (size.y > size[axis]) axis = 1;
+		if (size.z > size[axis]) axis = 2;
+
+		split = begin + count / 2;
+
+		std::nth_element(&b.order[begin], &b.order[split], &b.order[begin] + count, [&](int l, int r)
+		{
+			return b.centers[l][axis] < b.centers[r][axis];
+		});
+	}
+
+	// Both children are added together, so they are next to each other.
+	// This can move the node pool, so node can't be used after this
+	int firstChild = (int)b.nodes->size() - b.firstNode;
+	b.nodes->push_back(bvhNode());
+	b.nodes->push_back(bvhNode());
+
+	bvhNode& parent = (*b.nodes)[b.firstNode + nodeIndex];
+	parent.firstChild = firstChild;
+	parent.firstTriangle = 0;
+	parent.numTriangles = 0;
+
+	BuildNode(b, firstChild, begin, split, depth + 1);
+	BuildNode(b, firstChild + 1, split, end, depth + 1);
+}
+
+void BuildBVH(Mesh* m, std::vector<triangle>& triangles, std::vector<triangleAttributes>& attributes,
+	const std::vector<glm::vec4>& vertices, std::vector<bvhNode>& nodes, BvhStats& stats)
+{
+	stats = BvhStats();
+
+	m->firstNode = (int)nodes.size();
+	m->numNodes = 0;
+
+	// an empty mesh has no BVH, rays will skip it
+	if (m->numTriangles == 0)
+		return;
+
+	triangle* t = &triangles[m->firstTriangle];
+	triangleAttributes* a = &attributes[m->firstTriangle];
+	const glm::vec4* v = &vertices[m->firstVertex];
+
+	BvhBuilder b;
+	b.nodes = &nodes;
+	b.firstNode = m->firstNode;
+	b.itemCost = SAH_TRIANGLE_COST;
+	b.stats = &stats;
+
+	for (int i = 0; i < m->numTriangles; i++)
+	{
+		BvhBox box;
+
+		for (int j = 0; j < 3; j++)
+			box.grow(glm::vec3(v[t[i].v[j]]));
+
+		b.boxes.push_back(box);
+		b.centers.push_back((box.min + box.max) * 0.5f);
+		b.order.push_back(i);
+	}
+
+	// the root
+	nodes.push_back(bvhNode());
+	BuildNode(b, 0, 0, m->numTriangles, 0);
+
+	m->numNodes = (int)nodes.size() - m->firstNode;
+
+	// Sort the triangles of the mesh, so that the triangles
+	// of each leaf are next to each other
+	std::vector<triangle> sortedTriangles(m->numTriangles);
+	std::vector<triangleAttributes> sortedAttributes(m->numTriangles);
+
+	for (int i = 0; i < m->numTriangles; i++)
+	{
+		sortedTriangles[i] = t[b.order[i]];
+		sortedAttributes[i] = a[b.order[i]];
+	}
+
+	std::copy(sortedTriangles.begin(), sortedTriangles.end(), t);
+	std::copy(sortedAttributes.begin(), sortedAttributes.end(), a);
+
+	stats.numNodes = m->numNodes;
+	stats.numLostTriangles = CountLostTriangles(m, t, v, nodes);
+}
+
+// Grows box by node's box, after it is moved by matrix. Moving the 8
+// corners would work, but there is a faster way (by Jim Arvo): the new
+// center is the old center moved by the matrix, and the new half size on
+// each axis is the old half size times the absolute value of the rotation
+static void GrowByTransformedNode(BvhBox& box, const bvhNode& node, const glm::mat4x4& matrix)
+{
+	glm::vec3 center = glm::vec3(node.min + node.max) * 0.5f;
+	glm::vec3 half = glm::vec3(node.max - node.min) * 0.5f;
+
+	glm::vec3 newCenter = glm::vec3(matrix * glm::vec4(center, 1.0f));
+	glm::vec3 newHalf = glm::vec3(0);
+
+	// glm matrices are stored column by column
+	for (int c = 0; c < 3; c++)
+		newHalf += glm::abs(glm::vec3(matrix[c])) * half[c];
+
+	box.grow(newCenter - newHalf);
+	box.grow(newCenter + newHalf);
+}
+
+static void GrowByTransformedBVH(BvhBox& box, const bvhNode* nodes, int nodeIndex, const glm::mat4x4& matrix, int depth)
+{
+	const bvhNode& node = nodes[nodeIndex];
+
+	if (node.numTriangles > 0 || depth == BVH_BOUNDS_DEPTH)
+	{
+		GrowByTransformedNode(box, node, matrix);
+		return;
+	}
+
+	GrowByTransformedBVH(box, nodes, node.firstChild, matrix, depth + 1);
+	GrowByTransformedBVH(box, nodes, node.firstChild + 1, matrix, depth + 1);
+}
+
+void TransformBVHBounds(const bvhNode* nodes, const glm::mat4x4& matrix, glm::vec3& min, glm::vec3& max)
+{
+	BvhBox box;
+	GrowByTransformedBVH(box, nodes, 0, matrix, 0);
+
+	min = box.min;
+	max = box.max;
+}
+
+void BuildTLAS(const glm::vec3* mins, const glm::vec3* maxs, const int* ids, int count,
+	std::vector<bvhNode>& nodes, std::vector<int>& instances)
+{
+	nodes.clear();
+	instances.clear();
+
+	// nothing is in the world, rays will skip the whole tree
+	if (count == 0)
+		return;
+
+	BvhStats stats = BvhStats();
+
+	BvhBuilder b;
+	b.nodes = &nodes;
+	b.firstNode = 0;
+	b.itemCost = SAH_INSTANCE_COST;
+	b.stats = &stats;
+
+	for (int i = 0; i < count; i++)
+	{
+		BvhBox box;
+		box.grow(mins[i]);
+		box.grow(maxs[i]);
+
+		b.boxes.push_back(box);
+		b.centers.push_back((box.min + box.max) * 0.5f);
+		b.order.push_back(i);
+	}
+
+	nodes.push_back(bvhNode());
+	BuildNode(b, 0, 0, count, 0);
+
+	// The leaves point into this list, which
+	// says which mesh each item of a leaf is
+	for (int i = 0; i < count; i++)
+		instances.push_back(ids[b.order[i]]);
+}
@@ -0,0 +1,97 @@
+/*
+Title: Basic Ray Tracer
+File Name: Bvh.h
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Builds a bounding volume hierarchy (BVH) for every mesh when the scene
+// is loaded. Each node is a box around some triangles of the mesh, with
+// two smaller boxes inside it, until the boxes only have a few triangles.
+// A ray that misses a box can skip every triangle inside of it, so a ray
+// tests about log(n) boxes instead of n triangles
+
+#pragma once
+
+#include <vector>
+
+#include "Scene.h"
+
+// The surface area heuristic (SAH) guesses how expensive a split is. The
+// chance that a ray hits a box is its surface area divided by the surface
+// area of its parent, so a split costs:
+//   SAH_BOX_COST * (areaLeft + areaRight) / areaParent +
+//   SAH_TRIANGLE_COST * (areaLeft * trianglesLeft + areaRight * trianglesRight) / areaParent
+// Rays test a box with the slab test (intersectBox in FragmentShader.glsl),
+// a few multiplies and compares, which costs a bit less than a triangle
+#define SAH_TRIANGLE_COST 1.0f
+#define SAH_BOX_COST 0.5f
+
+// Testing a mesh in the top level BVH means moving the ray into
+// object space and testing the root of its BVH, so it costs more
+// than one box. This keeps meshes that overlap in the same leaf
+#define SAH_INSTANCE_COST (4 * SAH_BOX_COST)
+
+// Triangles are sorted into this many bins along each axis,
+// and the SAH is only checked at the edges between bins
+#define SAH_NUM_BINS 12
+
+// A leaf with more triangles than this is split in half, even when the
+// SAH finds no good split (like when every triangle has the same center),
+// so that no leaf is slow to test. Leaves at the deepest level that the
+// ray stack allows can still be bigger
+#define BVH_MAX_LEAF_TRIANGLES 8
+
+// The box of a mesh in the world is made from the boxes of its BVH this
+// many levels below the root (up to 16 boxes), instead of from the root
+// alone. When a mesh turns, its root box turns with it, and the box around
+// the turned box is much bigger than the mesh. The smaller boxes hug the
+// mesh, so the box around all of them stays close to the mesh at any angle
+#define BVH_BOUNDS_DEPTH 4
+
+// What the BVH of one mesh looks like
+struct BvhStats
+{
+	int numNodes;
+	int numLeaves;
+	int maxDepth;
+	int maxTrianglesPerLeaf;
+	int numLostTriangles;	// triangles that are not inside the box of exactly one leaf, this should be 0
+};
+
+// Builds the BVH of mesh m, and adds its nodes to the end of nodes.
+// The triangles of the mesh (and their attributes) are sorted, so
+// that the triangles of each leaf are next to each other. The points
+// in vertices don't move, the triangles keep their indices
+void BuildBVH(Mesh* m, std::vector<triangle>& triangles, std::vector<triangleAttributes>& attributes,
+	const std::vector<glm::vec4>& vertices, std::vector<bvhNode>& nodes, BvhStats& stats);
+
+// Finds the box in the world around a mesh that is moved by matrix.
+// nodes is the mesh's BVH, with the root first. The nodes that are
+// BVH_BOUNDS_DEPTH levels down (or leaves above that) are moved, and
+// min and max are set to the box around all of them
+void TransformBVHBounds(const bvhNode* nodes, const glm::mat4x4& matrix, glm::vec3& min, glm::vec3& max);
+
+// Builds the top level BVH, over the world space boxes (mins[i] to maxs[i])
+// of count meshes. nodes and instances are replaced. A leaf has a range
+// of instances, and instances has the mesh index (ids[i]) of each item
+void BuildTLAS(const glm::vec3* mins, const glm::vec3* maxs, const int* ids, int count,
+	std::vector<bvhNode>& nodes, std::vector<int>& instances);
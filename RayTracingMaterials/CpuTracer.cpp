@@ -0,0 +1,771 @@
+/*
+Title: Basic Ray Tracer
+File Name: CpuTracer.cpp
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+
+#include "CpuTracer.h"
+#include "Quantize.h"
+
+// Create some constants, the same as FragmentShader.glsl
+#define MAX_SCENE_BOUNDS 100.0f
+
+// Pixels are traced in square tiles, so that one
+// thread works on pixels that are close together
+#define TILE_SIZE 16
+
+struct hitinfo
+{
+	glm::vec3 point;
+	glm::vec3 objectPoint; // point, in the object space of the mesh
+	int m; // index of the instance
+	int t; // index of the triangle in the triangle pool
+};
+
+// Everything one thread needs while it traces
+struct TraceContext
+{
+	const CpuFrame* frame;
+	unsigned long long rays;
+	unsigned long long triangleTests;
+};
+
+// Determines whether or not a ray in a given direction hits a given triangle.
+// This is the same Moller-Trumbore test as rayIntersectsTriangle in FragmentShader.glsl
+static float rayIntersectsTriangle(glm::vec3 p, glm::vec3 d, glm::vec3 v0, glm::vec3 v1, glm::vec3 v2)
+{
+	glm::vec3 e1 = v1 - v0;
+	glm::vec3 e2 = v2 - v0;
+	glm::vec3 h = glm::cross(d, e2);
+	float a = glm::dot(e1, h);
+
+	if (a > -0.00001f && a < 0.00001f)
+		return -1.0f;
+
+	float f = 1 / a;
+	glm::vec3 s = p - v0;
+	float u = f * glm::dot(s, h);
+
+	if (u < 0.0f || u > 1.0f)
+		return -1.0f;
+
+	glm::vec3 q = glm::cross(s, e1);
+	float v = f * glm::dot(d, q);
+
+	if (v < 0.0f || u + v > 1.0f)
+		return -1.0f;
+
+	float t = f * glm::dot(e2, q);
+
+	if (t > 0.00001f)
+		return t;
+
+	return -1.0f;
+}
+
+// The slab test, the same as intersectBox in FragmentShader.glsl.
+// Returns -1 if the ray misses the box, otherwise the distance where
+// the ray enters it, which is 0 if the ray starts inside of it
+static float intersectBox(glm::vec3 origin, glm::vec3 invDir, glm::vec4 boxMin, glm::vec4 boxMax)
+{
+	glm::vec3 t0 = (glm::vec3(boxMin) - origin) * invDir;
+	glm::vec3 t1 = (glm::vec3(boxMax) - origin) * invDir;
+
+	glm::vec3 tNear = glm::min(t0, t1);
+	glm::vec3 tFar = glm::max(t0, t1);
+
+	float enter = glm::max(glm::max(tNear.x, tNear.y), glm::max(tNear.z, 0.0f));
+	float exit = glm::min(glm::min(tFar.x, tFar.y), tFar.z);
+
+	if (enter > exit)
+		return -1.0f;
+
+	return enter;
+}
+
+// A stack of nodes to visit, and how far away the ray enters each of their boxes
+struct NodeStack
+{
+	int node[BVH_STACK_SIZE];
+	float dist[BVH_STACK_SIZE];
+	int size = 0;
+
+	void push(int n, float d)
+	{
+		node[size] = n;
+		dist[size] = d;
+		size++;
+	}
+};
+
+// Test the boxes of both children of an inner node, and add the ones that the
+// ray hits before smallest to the stack, with the closer child on top, so it
+// is visited first. Distances are multiplied by scale to compare them to smallest
+static void pushChildren(NodeStack& stack, const bvhNode* nodes, int left, glm::vec3 origin, glm::vec3 invDir, float scale, float smallest)
+{
+	int right = left + 1;
+
+	float leftDist = intersectBox(origin, invDir, nodes[left].min, nodes[left].max);
+	float rightDist = intersectBox(origin, invDir, nodes[right].min, nodes[right].max);
+
+	bool hitLeft = leftDist != -1.0f && leftDist * scale < smallest;
+	bool hitRight = rightDist != -1.0f && rightDist * scale < smallest;
+
+	if (hitLeft && hitRight)
+	{
+		// the farther child goes on the stack first
+		if (leftDist < rightDist)
+		{
+			stack.push(right, rightDist);
+			stack.push(left, leftDist);
+		}
+		else
+		{
+			stack.push(left, leftDist);
+			stack.push(right, rightDist);
+		}
+	}
+	else if (hitLeft)
+		stack.push(left, leftDist);
+	else if (hitRight)
+		stack.push(right, rightDist);
+}
+
+// Test one triangle, and keep it if it is the closest so far. The ray
+// is in object space, and scale turns its distances into world units.
+// vertices starts at the first vertex of the mesh
+static void intersectTriangle(TraceContext& ctx, glm::vec3 origin, glm::vec3 dir, float scale, const triangle* triangles, const glm::vec4* vertices,
+	int instanceIndex, int triangleIndex, float& smallest, hitinfo& info, bool& found)
+{
+	const triangle& t = triangles[triangleIndex];
+
+	ctx.triangleTests++;
+
+	// Optimization to see if the polygon is facing
+	// a direction that the ray can hit
+	if (glm::dot(glm::vec3(t.faceNormal), dir) > 0)
+		return;
+
+	float d = rayIntersectsTriangle(origin, dir, glm::vec3(vertices[t.v[0]]), glm::vec3(vertices[t.v[1]]), glm::vec3(vertices[t.v[2]]));
+
+	if (d != -1.0f && d * scale < smallest)
+	{
+		smallest = d * scale;
+		info.objectPoint = origin + (dir * d);
+		info.m = instanceIndex;
+		info.t = triangleIndex;
+		found = true;
+	}
+}
+
+// Test a ray against the BVH of the mesh of instance i, see intersectMesh in FragmentShader.glsl
+static void intersectMesh(TraceContext& ctx, int i, glm::vec3 origin, glm::vec3 dir,
+	float& smallest, hitinfo& info, bool& found)
+{
+	const Mesh& mesh = ctx.frame->meshes[ctx.frame->instances[i].mesh];
+	const triangle* triangles = ctx.frame->triangles;
+	const glm::vec4* vertices = ctx.frame->vertices + mesh.firstVertex;
+	const bvhNode* nodes = ctx.frame->nodes;
+	const glm::mat4x4& worldToObject = ctx.frame->instances[i].worldToObject;
+
+	// Move the ray into the object space of the mesh. The direction is
+	// normalized again, and scale turns object distances into world distances
+	glm::vec3 objOrigin = glm::vec3(worldToObject * glm::vec4(origin, 1));
+	glm::vec3 objDir = glm::mat3(worldToObject) * dir;
+	float scale = 1.0f / glm::length(objDir);
+	objDir *= scale;
+	glm::vec3 objInvDir = 1.0f / objDir;
+
+	// Skip the mesh if the ray misses its box, or if
+	// a closer triangle was already found in another mesh
+	int root = mesh.firstNode;
+	float rootDist = intersectBox(objOrigin, objInvDir, nodes[root].min, nodes[root].max);
+
+	if (rootDist == -1.0f || rootDist * scale >= smallest)
+		return;
+
+	NodeStack stack;
+	stack.push(root, rootDist);
+
+	while (stack.size > 0)
+	{
+		stack.size--;
+		const bvhNode& node = nodes[stack.node[stack.size]];
+
+		// A closer triangle was found after this box was
+		// added to the stack, so nothing inside it can be closer
+		if (stack.dist[stack.size] * scale >= smallest)
+			continue;
+
+		// Inner node, visit the closer child first
+		if (node.numTriangles == 0)
+		{
+			pushChildren(stack, nodes, root + node.firstChild, objOrigin, objInvDir, scale, smallest);
+			continue;
+		}
+
+		int firstTriangle = mesh.firstTriangle + node.firstTriangle;
+
+		for (int j = 0; j < node.numTriangles; j++)
+			intersectTriangle(ctx, objOrigin, objDir, scale, triangles, vertices, i, firstTriangle + j, smallest, info, found);
+	}
+}
+
+// Test a ray against every triangle in the scene, see intersectTriangles in FragmentShader.glsl
+static bool intersectTriangles(TraceContext& ctx, glm::vec3 origin, glm::vec3 dir, hitinfo& info)
+{
+	const CpuFrame& f = *ctx.frame;
+
+	float smallest = MAX_SCENE_BOUNDS;
+	bool found = false;
+
+	ctx.rays++;
+
+	// Nothing is in the world
+	if (f.numTlasNodes == 0)
+		return false;
+
+	glm::vec3 invDir = 1.0f / dir;
+
+	float rootDist = intersectBox(origin, invDir, f.tlasNodes[0].min, f.tlasNodes[0].max);
+
+	if (rootDist == -1.0f)
+		return false;
+
+	// The top level nodes that this ray still needs to visit
+	NodeStack stack;
+	stack.push(0, rootDist);
+
+	while (stack.size > 0)
+	{
+		stack.size--;
+		const bvhNode& node = f.tlasNodes[stack.node[stack.size]];
+
+		if (stack.dist[stack.size] >= smallest)
+			continue;
+
+		// Inner node, visit the closer child first
+		if (node.numTriangles == 0)
+		{
+			pushChildren(stack, f.tlasNodes, node.firstChild, origin, invDir, 1.0f, smallest);
+			continue;
+		}
+
+		for (int j = 0; j < node.numTriangles; j++)
+			intersectMesh(ctx, f.tlasInstances[node.firstTriangle + j], origin, dir, smallest, info, found);
+	}
+
+	// the closest hit, in world space
+	if (found)
+		info.point = origin + (dir * smallest);
+
+	return found;
+}
+
+// Barycentric coordinates of a point inside a triangle
+static glm::vec3 getBarycentric(glm::vec3 p, glm::vec3 a, glm::vec3 b, glm::vec3 c)
+{
+	glm::vec3 v0 = b - a;
+	glm::vec3 v1 = c - a;
+	glm::vec3 v2 = p - a;
+
+	float d00 = glm::dot(v0, v0);
+	float d01 = glm::dot(v0, v1);
+	float d11 = glm::dot(v1, v1);
+	float d20 = glm::dot(v2, v0);
+	float d21 = glm::dot(v2, v1);
+	float denom = d00 * d11 - d01 * d01;
+
+	float v = (d11 * d20 - d01 * d21) / denom;
+	float w = (d00 * d21 - d01 * d20) / denom;
+	float u = 1.0f - v - w;
+
+	return glm::vec3(u, v, w);
+}
+
+// The normal and UV of point v of the vertex pool,
+// from the packed pool with --quantize
+static glm::vec3 getVertexNormal(const CpuFrame& f, int v)
+{
+	if (f.packedVertexAttribs)
+		return UnpackNormal(f.packedVertexAttribs[v].normal);
+
+	return glm::vec3(f.vertexAttribs[v].normal);
+}
+
+static glm::vec2 getVertexUV(const CpuFrame& f, int v)
+{
+	if (f.packedVertexAttribs)
+		return UnpackUV(f.packedVertexAttribs[v].uv);
+
+	return glm::vec2(f.vertexAttribs[v].uv);
+}
+
+// The point and the normals are in object space. firstVertex
+// is the first vertex of the mesh of the triangle
+static glm::vec3 GetInterpolatedNormal(const CpuFrame& f, int firstVertex, glm::vec3 objectPoint, const triangle& t)
+{
+	glm::ivec3 v = glm::ivec3(t.v[0], t.v[1], t.v[2]) + firstVertex;
+	glm::vec3 b = getBarycentric(objectPoint, glm::vec3(f.vertices[v.x]), glm::vec3(f.vertices[v.y]), glm::vec3(f.vertices[v.z]));
+
+	glm::vec3 newNormal =
+		b.x * getVertexNormal(f, v.x) +
+		b.y * getVertexNormal(f, v.y) +
+		b.z * getVertexNormal(f, v.z);
+
+	return glm::normalize(newNormal);
+}
+
+static glm::vec2 GetInterpolatedUV(const CpuFrame& f, int firstVertex, glm::vec3 objectPoint, const triangle& t)
+{
+	glm::ivec3 v = glm::ivec3(t.v[0], t.v[1], t.v[2]) + firstVertex;
+	glm::vec3 b = getBarycentric(objectPoint, glm::vec3(f.vertices[v.x]), glm::vec3(f.vertices[v.y]), glm::vec3(f.vertices[v.z]));
+
+	return
+		b.x * getVertexUV(f, v.x) +
+		b.y * getVertexUV(f, v.y) +
+		b.z * getVertexUV(f, v.z);
+}
+
+// Bilinear filtering with GL_REPEAT wrapping
+static glm::vec4 sampleTexture(const CpuTexture* tex, glm::vec2 uv)
+{
+	if (tex == nullptr || tex->bits.empty())
+		return glm::vec4(1);
+
+	float x = uv.x * tex->width - 0.5f;
+	float y = uv.y * tex->height - 0.5f;
+
+	float fx = std::floor(x);
+	float fy = std::floor(y);
+
+	float tx = x - fx;
+	float ty = y - fy;
+
+	int x0 = (int)fx % tex->width;
+	int y0 = (int)fy % tex->height;
+
+	if (x0 < 0) x0 += tex->width;
+	if (y0 < 0) y0 += tex->height;
+
+	int x1 = (x0 + 1) % tex->width;
+	int y1 = (y0 + 1) % tex->height;
+
+	// BGRA to RGBA
+	auto texel = [tex](int px, int py)
+	{
+		const unsigned char* b = &tex->bits[4 * ((size_t)py * tex->width + px)];
+		return glm::vec4(b[2], b[1], b[0], b[3]) / 255.0f;
+	};
+
+	return glm::mix(
+		glm::mix(texel(x0, y0), texel(x1, y0), tx),
+		glm::mix(texel(x0, y1), texel(x1, y1), tx),
+		ty);
+}
+
+static glm::vec4 getSurfaceColor(TraceContext& ctx, const hitinfo& i)
+{
+	const CpuFrame& f = *ctx.frame;
+	const triangle& t = f.triangles[i.t];
+
+	glm::vec4 color = f.palette ? f.palette[t.color] : f.attributes[i.t].color;
+	glm::vec4 triangleColor = glm::vec4(glm::vec3(color), 1);
+	glm::vec2 uv = GetInterpolatedUV(f, f.meshes[f.instances[i.m].mesh].firstVertex, i.objectPoint, t);
+
+	return sampleTexture(&f.textures[f.instances[i.m].texture], uv) * triangleColor;
+}
+
+// The interpolated normal of triangle triangleIndex of instance instanceIndex,
+// at objectPoint, turned into world space with the inverse transpose matrix
+static glm::vec3 getWorldNormal(TraceContext& ctx, int instanceIndex, int triangleIndex, glm::vec3 objectPoint)
+{
+	const CpuFrame& f = *ctx.frame;
+	const triangle& t = f.triangles[triangleIndex];
+	const instance& in = f.instances[instanceIndex];
+
+	glm::vec3 normal = GetInterpolatedNormal(f, f.meshes[in.mesh].firstVertex, objectPoint, t);
+
+	return glm::normalize(glm::transpose(glm::mat3(in.worldToObject)) * normal);
+}
+
+static glm::vec3 addLightColorToPixColor(TraceContext& ctx, const light& L, glm::vec3 dirRayToPoint, const hitinfo& rayHitPoint)
+{
+	const instance* instances = ctx.frame->instances;
+
+	// get direction from point to light
+	glm::vec3 pointToLight = glm::vec3(L.pos) - rayHitPoint.point;
+
+	// Get the distance from point on surface to light
+	float dist = glm::length(pointToLight);
+
+	// Don't process the light if the light doesn't touch the pixel anyways
+	if (dist > L.radius)
+		return glm::vec3(0);
+
+	pointToLight = glm::normalize(pointToLight);
+
+	// If a polygon blocks the ray from the light, this point is in shadow
+	hitinfo lightHitPoint;
+
+	if (intersectTriangles(ctx, glm::vec3(L.pos), -pointToLight, lightHitPoint))
+	{
+		if (dist - glm::length(glm::vec3(L.pos) - lightHitPoint.point) > 0.1f)
+			return glm::vec3(0);
+	}
+
+	glm::vec3 normal = getWorldNormal(ctx, rayHitPoint.m, rayHitPoint.t, rayHitPoint.objectPoint);
+
+	glm::vec3 reflectedRayToPoint = glm::reflect(pointToLight, normal);
+
+	float NdotL = glm::clamp(glm::dot(normal, pointToLight), 0.0f, 1.0f);
+
+	// Formula for range-based attenuation
+	float atten = 1.0f - (dist * dist) / (L.radius * L.radius);
+	atten = glm::clamp(atten, 0.0f, 1.0f);
+
+	float diffuse = NdotL;
+	float specular = 0.0f;
+
+	int maxBounces = instances[rayHitPoint.m].reflectionLevel;
+
+	// GLSL pow() is undefined for a negative base, and the GPU
+	// gives no highlight there, so we only raise positive values
+	if (maxBounces != 0)
+	{
+		float RdotV = glm::dot(reflectedRayToPoint, dirRayToPoint);
+		specular = RdotV > 0 ? std::pow(RdotV, 64.0f) : 0.0f;
+	}
+
+	glm::vec3 brightness = L.brightness * glm::vec3(L.color) * atten;
+
+	glm::vec4 surfaceColor = getSurfaceColor(ctx, rayHitPoint);
+
+	glm::vec3 finalColor = glm::vec3(surfaceColor) * brightness * diffuse;
+
+	if (maxBounces != 0)
+		finalColor += brightness * specular;
+
+	return finalColor;
+}
+
+static glm::vec3 addReflectionToPixColor(TraceContext& ctx, const light& L, glm::vec3 dir, hitinfo rayHitPoint, bool& endEarly)
+{
+	const instance* instances = ctx.frame->instances;
+
+	endEarly = false;
+
+	hitinfo reflectHit;
+	glm::vec3 color = glm::vec3(0);
+
+	// get reflectivity level from the instance
+	int maxBounces = instances[rayHitPoint.m].reflectionLevel;
+
+	// The shader keeps using the first triangle's normal for
+	// every bounce, and so do we, so both images match
+	hitinfo h = rayHitPoint;
+	const glm::mat4x4& worldToObject = ctx.frame->instances[h.m].worldToObject;
+
+	for (int i = 0; i < maxBounces; i++)
+	{
+		glm::vec3 objectPoint = glm::vec3(worldToObject * glm::vec4(rayHitPoint.point, 1));
+		glm::vec3 normal = getWorldNormal(ctx, h.m, h.t, objectPoint);
+
+		glm::vec3 reflectedRayToPoint = glm::reflect(dir, normal);
+
+		// If we hit nothing, exit the loop
+		if (!intersectTriangles(ctx, rayHitPoint.point, reflectedRayToPoint, reflectHit))
+			break;
+
+		// If you are reflecting a surface that has no effects,
+		// return the color of that surface, with no more bounces
+		if (instances[reflectHit.m].boolUseEffects == 0)
+		{
+			color += glm::vec3(getSurfaceColor(ctx, reflectHit)) * std::pow(0.5f, (float)i);
+			endEarly = true;
+			break;
+		}
+
+		color += addLightColorToPixColor(ctx, L, reflectedRayToPoint, reflectHit) * std::pow(0.5f, (float)i);
+
+		if (instances[reflectHit.m].reflectionLevel == 0)
+			break;
+
+		dir = reflectedRayToPoint;
+		rayHitPoint = reflectHit;
+	}
+
+	return color;
+}
+
+// Trace a ray from an origin point in a given direction and return the color of the point that ray hits.
+static glm::vec4 trace(TraceContext& ctx, glm::vec3 origin, glm::vec3 dirEyeToTriangle)
+{
+	const instance* instances = ctx.frame->instances;
+
+	hitinfo eyeHitTriangle;
+
+	// If the ray doesn't hit any triangles, then this ray sees nothing
+	if (!intersectTriangles(ctx, origin, dirEyeToTriangle, eyeHitTriangle))
+		return glm::vec4(glm::vec3(0), 1.0f);
+
+	glm::vec4 surfaceColor = getSurfaceColor(ctx, eyeHitTriangle);
+
+	// If you dont want any effects on this object
+	if (instances[eyeHitTriangle.m].boolUseEffects == 0)
+		return surfaceColor;
+
+	glm::vec3 pixColor;
+
+	// set ambient occlusion low if you can reflect,
+	// otherwise fake ambient occlusion to match sky
+	if (instances[eyeHitTriangle.m].reflectionLevel != 0)
+		pixColor = glm::vec3(surfaceColor) * 0.1f;
+	else
+		pixColor = glm::vec3(surfaceColor) * glm::vec3(0.15f, 0.15f, 0.3f);
+
+	bool endEarly = false;
+
+	for (int j = 0; j < ctx.frame->numLights; j++)
+	{
+		const light& L = ctx.frame->lights[j];
+
+		glm::vec3 lightColor = addLightColorToPixColor(ctx, L, dirEyeToTriangle, eyeHitTriangle);
+
+		glm::vec3 reflection = glm::vec3(0);
+
+		if (!endEarly && instances[eyeHitTriangle.m].reflectionLevel != 0)
+		{
+			reflection = addReflectionToPixColor(ctx, L, dirEyeToTriangle, eyeHitTriangle, endEarly);
+			reflection *= glm::vec3(surfaceColor);
+		}
+
+		// blend the light and the reflection half and half
+		pixColor += glm::mix(lightColor, reflection, 0.5f);
+	}
+
+	return glm::vec4(pixColor, 1.0f);
+}
+
+// Same as the conversion the GPU does when it writes to an 8-bit framebuffer
+static unsigned char toByte(float c)
+{
+	return (unsigned char)(glm::clamp(c, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+static void renderTile(TraceContext& ctx, int tile, unsigned char* pixels)
+{
+	const CpuFrame& f = *ctx.frame;
+
+	int tilesX = (f.width + TILE_SIZE - 1) / TILE_SIZE;
+
+	int x0 = (tile % tilesX) * TILE_SIZE;
+	int y0 = (tile / tilesX) * TILE_SIZE;
+
+	int x1 = glm::min(x0 + TILE_SIZE, f.width);
+	int y1 = glm::min(y0 + TILE_SIZE, f.height);
+
+	for (int y = y0; y < y1; y++)
+	{
+		for (int x = x0; x < x1; x++)
+		{
+			// the same as textureCoord in the fragment shader, at the center of the pixel
+			glm::vec2 pos = glm::vec2((x + 0.5f) / f.width, (y + 0.5f) / f.height);
+			glm::vec3 dir = glm::normalize(glm::mix(glm::mix(f.ray00, f.ray01, pos.y), glm::mix(f.ray10, f.ray11, pos.y), pos.x));
+
+			glm::vec4 color = trace(ctx, f.eye, dir);
+
+			// BGR, like glReadPixels with GL_BGR
+			unsigned char* p = &pixels[3 * ((size_t)y * f.width + x)];
+			p[0] = toByte(color.b);
+			p[1] = toByte(color.g);
+			p[2] = toByte(color.r);
+		}
+	}
+}
+
+// Work stealing
+// --------------------------
+// Every thread owns a range of tiles [begin, end), packed into one 64-bit
+// atomic. The owner takes tiles from the front, and a thread that runs
+// out of work steals the back half of someone else's range. Both sides
+// use compare-exchange on the same value, so every tile is taken once,
+// and expensive tiles (reflective car, dense meshes) never leave threads idle
+
+struct alignas(64) TileRange
+{
+	std::atomic<uint64_t> range;
+};
+
+static uint64_t packRange(uint32_t begin, uint32_t end)
+{
+	return ((uint64_t)end << 32) | begin;
+}
+
+// Take the first tile of our own range
+static bool popTile(TileRange& own, int& tile)
+{
+	uint64_t r = own.range.load();
+
+	while (true)
+	{
+		uint32_t begin = (uint32_t)r;
+		uint32_t end = (uint32_t)(r >> 32);
+
+		if (begin >= end)
+			return false;
+
+		if (own.range.compare_exchange_weak(r, packRange(begin + 1, end)))
+		{
+			tile = (int)begin;
+			return true;
+		}
+	}
+}
+
+// Take the back half of another thread's range
+static bool stealTiles(TileRange& victim, uint32_t& begin, uint32_t& end)
+{
+	uint64_t r = victim.range.load();
+
+	while (true)
+	{
+		uint32_t b = (uint32_t)r;
+		uint32_t e = (uint32_t)(r >> 32);
+
+		if (b >= e)
+			return false;
+
+		uint32_t mid = b + (e - b) / 2;
+
+		if (victim.range.compare_exchange_weak(r, packRange(b, mid)))
+		{
+			begin = mid;
+			end = e;
+			return true;
+		}
+	}
+}
+
+static void renderWorker(int threadIndex, int numThreads, TileRange* ranges, const CpuFrame* frame, unsigned char* pixels, TraceContext* results)
+{
+	TraceContext ctx;
+	ctx.frame = frame;
+	ctx.rays = 0;
+	ctx.triangleTests = 0;
+
+	TileRange& own = ranges[threadIndex];
+
+	while (true)
+	{
+		int tile;
+
+		while (popTile(own, tile))
+			renderTile(ctx, tile, pixels);
+
+		// Our tiles are done, look for someone with tiles left
+		bool stole = false;
+
+		for (int i = 1; i < numThreads && !stole; i++)
+		{
+			uint32_t begin, end;
+
+			if (stealTiles(ranges[(threadIndex + i) % numThreads], begin, end))
+			{
+				own.range.store(packRange(begin, end));
+				stole = true;
+			}
+		}
+
+		// Nobody has tiles left, the frame is done
+		if (!stole)
+			break;
+	}
+
+	results[threadIndex] = ctx;
+}
+
+int cpuThreadCount()
+{
+	int n = (int)std::thread::hardware_concurrency();
+	return n > 0 ? n : 1;
+}
+
+void cpuRenderFrame(const CpuFrame& frame, unsigned char* pixels, CpuStats& stats)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	int numThreads = cpuThreadCount();
+
+	int tilesX = (frame.width + TILE_SIZE - 1) / TILE_SIZE;
+	int tilesY = (frame.height + TILE_SIZE - 1) / TILE_SIZE;
+	int numTiles = tilesX * tilesY;
+
+	// Start each thread with an equal slice of rows of tiles
+	std::vector<TileRange> ranges(numThreads);
+	std::vector<TraceContext> results(numThreads);
+
+	for (int i = 0; i < numThreads; i++)
+	{
+		uint32_t begin = (uint32_t)((long long)numTiles * i / numThreads);
+		uint32_t end = (uint32_t)((long long)numTiles * (i + 1) / numThreads);
+		ranges[i].range.store(packRange(begin, end));
+	}
+
+	// This thread works too, as thread 0
+	std::vector<std::thread> threads;
+
+	for (int i = 1; i < numThreads; i++)
+		threads.push_back(std::thread(renderWorker, i, numThreads, ranges.data(), &frame, pixels, results.data()));
+
+	renderWorker(0, numThreads, ranges.data(), &frame, pixels, results.data());
+
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i].join();
+
+	stats.rays = 0;
+	stats.triangleTests = 0;
+
+	for (int i = 0; i < numThreads; i++)
+	{
+		stats.rays += results[i].rays;
+		stats.triangleTests += results[i].triangleTests;
+	}
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	stats.seconds = elapsed.count();
+}
+
+void cpuUpdateInstances(const glm::mat4x4* matrices, const int* ids, int count, instance* instances)
+{
+	for (int k = 0; k < count; k++)
+	{
+		instances[ids[k]].objectToWorld = matrices[k];
+		instances[ids[k]].worldToObject = glm::inverse(matrices[k]);
+	}
+}
@@ -0,0 +1,99 @@
+/*
+Title: Basic Ray Tracer
+File Name: CpuTracer.h
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// A CPU version of the ray tracer in FragmentShader.glsl, for machines that
+// have many cores but no GPU. It traces the same Mesh and light data that
+// the shaders get, and gives the same image (except for texture filtering,
+// which is bilinear here, with no mipmaps)
+
+#pragma once
+
+#include <vector>
+
+#include "Scene.h"
+
+// A decoded texture, kept in memory for the CPU tracer.
+// 32-bit BGRA pixels, bottom row first, just like FreeImage gives us
+struct CpuTexture
+{
+	int width = 0;
+	int height = 0;
+	std::vector<unsigned char> bits;
+};
+
+// Everything the CPU tracer needs to draw one frame. This is the same
+// data that the fragment shader gets from its buffers and uniforms
+struct CpuFrame
+{
+	const Mesh* meshes;						// like meshBuffer
+	const triangle* triangles;				// object space triangle pool, like triangleBuffer
+	const triangleAttributes* attributes;	// object space attribute pool, like attributeBuffer
+	const glm::vec4* vertices;				// object space vertex pool, like vertexBuffer
+	const vertexAttributes* vertexAttribs;	// object space vertex attribute pool, like vertexAttributeBuffer
+
+	// With --quantize, these are used instead of vertexAttribs and
+	// attributes (see Quantize.h), otherwise they are nullptr
+	const packedVertexAttributes* packedVertexAttribs;
+	const glm::vec4* palette;
+
+	const bvhNode* nodes;					// object space node pool, like nodeBuffer
+	const instance* instances;				// every instance, with its matrices, like instanceBuffer
+	const bvhNode* tlasNodes;				// top level BVH, like tlasNodeBuffer
+	const int* tlasInstances;				// instances in the top level leaves, like tlasInstanceBuffer
+	int numTlasNodes;
+	const light* lights;					// like lightToFrag
+	int numLights;
+	const CpuTexture* textures;				// like textureTest[]
+
+	// camera position, and the four corner rays from calcCameraRays
+	glm::vec3 eye;
+	glm::vec3 ray00;
+	glm::vec3 ray01;
+	glm::vec3 ray10;
+	glm::vec3 ray11;
+
+	int width;
+	int height;
+};
+
+// Statistics of the last frame
+struct CpuStats
+{
+	double seconds;
+	unsigned long long rays; // primary, shadow, and reflection rays
+	unsigned long long triangleTests; // triangles that rays were tested against
+};
+
+// The work of Compute.glsl: give instance ids[k] the model matrix
+// matrices[k], and the inverse of it, to move rays into object space.
+// Only the instances that moved are given, the rest are not touched
+void cpuUpdateInstances(const glm::mat4x4* matrices, const int* ids, int count, instance* instances);
+
+// Trace every pixel of the frame on every core. Pixels are written
+// as BGR, bottom row first, the same as glReadPixels gives us
+void cpuRenderFrame(const CpuFrame& frame, unsigned char* pixels, CpuStats& stats);
+
+// Number of threads that cpuRenderFrame uses
+int cpuThreadCount();
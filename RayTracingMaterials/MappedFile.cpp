@@ -0,0 +1,146 @@
+/*
+Title: Basic Ray Tracer
+File Name: MappedFile.cpp
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cstdio>
+
+#include "MappedFile.h"
+
+bool OpenMappedFile(const char* path, MappedFile& file)
+{
+	file = MappedFile();
+
+#ifdef _WIN32
+	HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+	if (handle == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	GetFileSizeEx(handle, &size);
+
+	file.file = handle;
+	file.size = (size_t)size.QuadPart;
+
+	// An empty file can't be mapped
+	if (file.size == 0)
+		return true;
+
+	file.mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+
+	if (file.mapping != NULL)
+		file.data = (const char*)MapViewOfFile(file.mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return false;
+
+	struct stat info;
+	fstat(fd, &info);
+
+	file.size = (size_t)info.st_size;
+
+	// An empty file can't be mapped
+	if (file.size == 0)
+	{
+		close(fd);
+		return true;
+	}
+
+	void* data = mmap(nullptr, file.size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	// The mapping keeps the file open, so we don't need the descriptor
+	close(fd);
+
+	if (data != MAP_FAILED)
+	{
+		// We read the file from the start to the end
+		madvise(data, file.size, MADV_SEQUENTIAL);
+		file.data = (const char*)data;
+	}
+#endif
+
+	if (file.data == nullptr)
+	{
+		CloseMappedFile(file);
+		return false;
+	}
+
+	return true;
+}
+
+void CloseMappedFile(MappedFile& file)
+{
+#ifdef _WIN32
+	if (file.data != nullptr)
+		UnmapViewOfFile(file.data);
+
+	if (file.mapping != nullptr)
+		CloseHandle((HANDLE)file.mapping);
+
+	if (file.file != nullptr)
+		CloseHandle((HANDLE)file.file);
+#else
+	if (file.data != nullptr)
+		munmap((void*)file.data, file.size);
+#endif
+
+	file = MappedFile();
+}
+
+std::string TempFilePath(const char* path)
+{
+#ifdef _WIN32
+	unsigned long id = GetCurrentProcessId();
+#else
+	unsigned long id = (unsigned long)getpid();
+#endif
+
+	return std::string(path) + "." + std::to_string(id) + ".tmp";
+}
+
+bool RenameOverFile(const char* from, const char* to)
+{
+#ifdef _WIN32
+	// rename won't replace a file on Windows
+	bool ok = MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	bool ok = rename(from, to) == 0;
+#endif
+
+	if (!ok)
+		remove(from);
+
+	return ok;
+}
@@ -0,0 +1,63 @@
+/*
+Title: Basic Ray Tracer
+File Name: MappedFile.h
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Maps a whole file into memory, read only. The operating system reads
+// the pages of the file when they are first touched, so there is no copy
+// into our own buffer, and no fread or fgets one small piece at a time
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+struct MappedFile
+{
+	const char* data = nullptr;
+	size_t size = 0;
+
+#ifdef _WIN32
+	void* file = nullptr;		// HANDLE of the file
+	void* mapping = nullptr;	// HANDLE of the file mapping
+#endif
+};
+
+// Maps the file at path. Returns false if the file can't be opened.
+// An empty file opens, with no data and a size of 0
+bool OpenMappedFile(const char* path, MappedFile& file);
+
+// Unmaps the file, data can't be used after this
+void CloseMappedFile(MappedFile& file);
+
+// A file that other programs might have mapped is never written in place,
+// because they would see it change under them, or crash when it gets
+// shorter. It is written to TempFilePath(path) (a name that only this
+// program uses) and then put in place with RenameOverFile. Anyone who has
+// the old file mapped keeps the old file, and nobody can see a file that
+// is only partly written
+std::string TempFilePath(const char* path);
+
+// Renames the file at from to to, and replaces to if it is there.
+// Returns false, and removes from, if that can't be done
+bool RenameOverFile(const char* from, const char* to);
@@ -0,0 +1,381 @@
+/*
+Title: Basic Ray Tracer
+File Name: MeshCache.cpp
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "MeshCache.h"
+#include "MappedFile.h"
+#include "ObjLoader.h"
+#include "StartupProfile.h"
+
+std::string MeshCachePath(const char* path)
+{
+	return std::string(path) + ".rtmesh";
+}
+
+// Gets the size and the last change time of a file,
+// so we can tell when an OBJ is not the one in its cache
+static bool GetSourceStamp(const char* path, long long& size, long long& time)
+{
+	struct stat info;
+
+	if (stat(path, &info) != 0)
+		return false;
+
+	size = (long long)info.st_size;
+	time = (long long)info.st_mtime;
+	return true;
+}
+
+// Everything that makes two points the same, compared bit by bit
+struct VertexKey
+{
+	glm::vec4 pos;
+	glm::vec4 uv;
+	glm::vec4 normal;
+
+	bool operator==(const VertexKey& other) const
+	{
+		return memcmp(this, &other, sizeof(VertexKey)) == 0;
+	}
+};
+
+// FNV-1a, over the bytes of the key
+struct VertexKeyHash
+{
+	size_t operator()(const VertexKey& key) const
+	{
+		const unsigned char* bytes = (const unsigned char*)&key;
+		unsigned int hash = 2166136261u;
+
+		for (size_t i = 0; i < sizeof(VertexKey); i++)
+			hash = (hash ^ bytes[i]) * 16777619u;
+
+		return hash;
+	}
+};
+
+// Puts the face normal of every triangle into faceNormal.
+// The winding order of a model is not always the same, so the normal
+// is flipped if it points away from the vertex normals
+static void StoreFaceNormals(MeshPools& pools)
+{
+	for (size_t i = 0; i < pools.triangles.size(); i++)
+	{
+		triangle& t = pools.triangles[i];
+
+		glm::vec3 p0 = glm::vec3(pools.vertices[t.v[0]]);
+		glm::vec3 p1 = glm::vec3(pools.vertices[t.v[1]]);
+		glm::vec3 p2 = glm::vec3(pools.vertices[t.v[2]]);
+
+		glm::vec3 faceNormal = glm::cross(p1 - p0, p2 - p0);
+		glm::vec3 vertexNormals =
+			glm::vec3(pools.vertexAttribs[t.v[0]].normal) +
+			glm::vec3(pools.vertexAttribs[t.v[1]].normal) +
+			glm::vec3(pools.vertexAttribs[t.v[2]].normal);
+
+		if (glm::dot(faceNormal, vertexNormals) < 0)
+			faceNormal = -faceNormal;
+
+		// a triangle with no area keeps a normal of 0,
+		// and will never be skipped
+		if (glm::length(faceNormal) > 0)
+			faceNormal = glm::normalize(faceNormal);
+
+		t.faceNormal = glm::vec4(faceNormal, 0);
+	}
+}
+
+void BuildMesh(Mesh* m, const expandedTriangle* t, int count, MeshData& data, BvhStats& stats)
+{
+	// Every point gets the index of the first point that is the same as it,
+	// so the vertices are in the order that the triangles first use them
+	std::unordered_map<VertexKey, int, VertexKeyHash> merged;
+	merged.reserve(count * 3);
+
+	MeshPools& pools = data.memory;
+	pools.triangles.resize(count);
+	pools.attributes.resize(count);
+
+	for (int i = 0; i < count; i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			VertexKey key = { t[i].pos[j], t[i].uv[j], t[i].normal[j] };
+			std::pair<std::unordered_map<VertexKey, int, VertexKeyHash>::iterator, bool> found =
+				merged.insert(std::make_pair(key, (int)pools.vertices.size()));
+
+			// a point that we have not seen yet
+			if (found.second)
+			{
+				vertexAttributes a;
+				a.normal = t[i].normal[j];
+				a.uv = t[i].uv[j];
+
+				pools.vertices.push_back(t[i].pos[j]);
+				pools.vertexAttribs.push_back(a);
+			}
+
+			pools.triangles[i].v[j] = found.first->second;
+		}
+
+		pools.triangles[i].color = 0;
+		pools.attributes[i].color = t[i].color;
+	}
+
+	m->firstTriangle = 0;
+	m->numTriangles = count;
+	m->firstVertex = 0;
+	m->numVertices = (int)pools.vertices.size();
+
+	// for skipping triangles that face away from rays
+	StoreFaceNormals(pools);
+
+	// this also sorts the triangles
+	BuildBVH(m, pools.triangles, pools.attributes, pools.vertices, pools.nodes, stats);
+
+	// the pools are done, and won't move again
+	data.numTriangles = count;
+	data.numVertices = (int)pools.vertices.size();
+	data.numNodes = (int)pools.nodes.size();
+	data.triangles = pools.triangles.data();
+	data.attributes = pools.attributes.data();
+	data.vertices = pools.vertices.data();
+	data.vertexAttribs = pools.vertexAttribs.data();
+	data.nodes = pools.nodes.data();
+}
+
+// The bytes of the pools of a mesh
+static long long MeshDataBytes(const MeshData& data)
+{
+	return (long long)((sizeof(triangle) + sizeof(triangleAttributes)) * (size_t)data.numTriangles +
+		(sizeof(glm::vec4) + sizeof(vertexAttributes)) * (size_t)data.numVertices +
+		sizeof(bvhNode) * (size_t)data.numNodes);
+}
+
+bool BuildObjMesh(const char* path, Mesh* m, MeshData& data, BvhStats& stats)
+{
+	double parseStart = ProfileTime();
+
+	// Part 1
+	// Read the positions, UVs, normals, and triangles of
+	// the file, see ObjLoader.cpp
+
+	ObjData obj;
+	int badFaces;
+
+	if (!LoadObjFile(path, obj, badFaces))
+		return false;
+
+	if (badFaces != 0)
+		printf("%s: skipped %d faces with indices that are not in the file\n", path, badFaces);
+
+
+	// Part 2
+	// Initialize more variables
+
+	int numTriangles = (int)obj.corners.size() / 3;
+	std::vector<expandedTriangle> t(numTriangles);
+
+
+	// Part 3
+	// Build final Vertex Buffer
+
+	// for every triangle
+	for (int i = 0; i < numTriangles; i++)
+	{
+		const ObjCorner* c = &obj.corners[3 * i];
+
+		glm::vec3 p0 = obj.positions[c[0].position];
+		glm::vec3 p1 = obj.positions[c[1].position];
+		glm::vec3 p2 = obj.positions[c[2].position];
+
+		// points that have no normal in the file use the face normal
+		glm::vec3 faceNormal = glm::cross(p1 - p0, p2 - p0);
+
+		if (glm::length(faceNormal) > 0)
+			faceNormal = glm::normalize(faceNormal);
+
+		// for every point
+		for (int j = 0; j < 3; j++)
+		{
+			t[i].pos[j] = glm::vec4(obj.positions[c[j].position], 1.0f);
+
+			glm::vec2 uv = c[j].uv != -1 ? obj.uvs[c[j].uv] : glm::vec2(0);
+			t[i].uv[j] = glm::vec4(uv, 0, 0);
+
+			glm::vec3 normal = c[j].normal != -1 ? obj.normals[c[j].normal] : faceNormal;
+			t[i].normal[j] = glm::vec4(normal, 1.0f);
+		}
+
+		t[i].color = glm::vec4(1.0, 1.0, 1.0, 1.0);
+	}
+
+	long long sourceSize, sourceTime;
+
+	if (!GetSourceStamp(path, sourceSize, sourceTime))
+		sourceSize = 0;
+
+	AddStartupPhase(std::string("parse ") + path, parseStart, sourceSize);
+
+
+	// Part 4
+	// Merge the points that are the same, and get it ready to trace
+
+	double buildStart = ProfileTime();
+
+	BuildMesh(m, t.data(), numTriangles, data, stats);
+
+	AddStartupPhase(std::string("build mesh and BVH ") + path, buildStart, MeshDataBytes(data));
+	return true;
+}
+
+bool ReadMeshCache(const char* path, Mesh* m, MeshData& data, BvhStats& stats)
+{
+	double start = ProfileTime();
+
+	long long sourceSize, sourceTime;
+
+	if (!GetSourceStamp(path, sourceSize, sourceTime))
+		return false;
+
+	MappedFile file;
+
+	if (!OpenMappedFile(MeshCachePath(path).c_str(), file))
+		return false;
+
+	// The header has to match this program and this OBJ,
+	// and the file has to be long enough for every part,
+	// or it was only partly written
+	const MeshCacheHeader* header = (const MeshCacheHeader*)file.data;
+	bool valid = file.size >= sizeof(MeshCacheHeader) &&
+		memcmp(header->magic, "RTMC", 4) == 0 &&
+		header->version == MESH_CACHE_VERSION &&
+		header->sourceSize == sourceSize &&
+		header->sourceTime == sourceTime &&
+		header->numTriangles >= 0 && header->numVertices >= 0 && header->numNodes >= 0 &&
+		file.size == sizeof(MeshCacheHeader) +
+			(sizeof(triangle) + sizeof(triangleAttributes)) * (size_t)header->numTriangles +
+			(sizeof(glm::vec4) + sizeof(vertexAttributes)) * (size_t)header->numVertices +
+			sizeof(bvhNode) * (size_t)header->numNodes;
+
+	if (!valid)
+	{
+		CloseMappedFile(file);
+		return false;
+	}
+
+	m->firstTriangle = 0;
+	m->numTriangles = header->numTriangles;
+	m->firstVertex = 0;
+	m->numVertices = header->numVertices;
+	m->firstNode = 0;
+	m->numNodes = header->numNodes;
+
+	// Every pool points straight into the mapping, nothing is
+	// copied until main.cpp adds the mesh to the pools of the scene
+	data.numTriangles = header->numTriangles;
+	data.numVertices = header->numVertices;
+	data.numNodes = header->numNodes;
+	data.triangles = (const triangle*)(header + 1);
+	data.attributes = (const triangleAttributes*)(data.triangles + data.numTriangles);
+	data.vertices = (const glm::vec4*)(data.attributes + data.numTriangles);
+	data.vertexAttribs = (const vertexAttributes*)(data.vertices + data.numVertices);
+	data.nodes = (const bvhNode*)(data.vertexAttribs + data.numVertices);
+	data.file = file;
+	stats = header->stats;
+
+	AddStartupPhase(std::string("map mesh cache ") + path, start, (long long)file.size);
+	return true;
+}
+
+bool WriteMeshCache(const char* path, const MeshData& data, const BvhStats& stats)
+{
+	double start = ProfileTime();
+
+	MeshCacheHeader header = {};
+	memcpy(header.magic, "RTMC", 4);
+	header.version = MESH_CACHE_VERSION;
+	header.numTriangles = data.numTriangles;
+	header.numVertices = data.numVertices;
+	header.numNodes = data.numNodes;
+	header.stats = stats;
+
+	if (!GetSourceStamp(path, header.sourceSize, header.sourceTime))
+		return false;
+
+	// written next to the cache file, and then renamed over
+	// it, see TempFilePath
+	std::string cachePath = MeshCachePath(path);
+	std::string tempPath = TempFilePath(cachePath.c_str());
+	FILE* f = fopen(tempPath.c_str(), "wb");
+
+	if (f == NULL)
+		return false;
+
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+		fwrite(data.triangles, sizeof(triangle), data.numTriangles, f) == (size_t)data.numTriangles &&
+		fwrite(data.attributes, sizeof(triangleAttributes), data.numTriangles, f) == (size_t)data.numTriangles &&
+		fwrite(data.vertices, sizeof(glm::vec4), data.numVertices, f) == (size_t)data.numVertices &&
+		fwrite(data.vertexAttribs, sizeof(vertexAttributes), data.numVertices, f) == (size_t)data.numVertices &&
+		fwrite(data.nodes, sizeof(bvhNode), data.numNodes, f) == (size_t)data.numNodes;
+
+	ok = fclose(f) == 0 && ok;
+
+	// don't leave half a file behind, if the disk is full
+	if (!ok)
+		remove(tempPath.c_str());
+	else
+		ok = RenameOverFile(tempPath.c_str(), cachePath.c_str());
+
+	AddStartupPhase(std::string("write mesh cache ") + path, start, ok ? (long long)sizeof(header) + MeshDataBytes(data) : 0);
+
+	return ok;
+}
+
+bool LoadMesh(const char* path, Mesh* m, MeshData& data, BvhStats& stats)
+{
+	if (ReadMeshCache(path, m, data, stats))
+		return true;
+
+	if (!BuildObjMesh(path, m, data, stats))
+		return false;
+
+	// The Assets folder might be read only, then
+	// we just read the OBJ again next time
+	if (!WriteMeshCache(path, data, stats))
+		printf("Can't write mesh cache: %s\n", MeshCachePath(path).c_str());
+
+	return true;
+}
+
+void FreeMeshData(MeshData& data)
+{
+	CloseMappedFile(data.file);
+	data = MeshData();
+}
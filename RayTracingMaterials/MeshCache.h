@@ -0,0 +1,135 @@
+/*
+Title: Basic Ray Tracer
+File Name: MeshCache.h
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Turns an OBJ file into a mesh that is ready to trace (shared points
+// merged, triangles with face normals, sorted by a BVH), and saves that
+// mesh in a binary cache file next to the OBJ. The next time the program
+// starts, the cache file is memory mapped, and each pool of the mesh is
+// copied straight out of the mapping into the pools of the scene, in one
+// block, so there is no parsing and no BVH to build. The cache is made again
+// if the OBJ changes, or if the layout of the data changes (MESH_CACHE_VERSION)
+
+// MeshConverter.cpp makes the cache files ahead of time, so that the
+// first start is fast too. Without it, the program makes them itself
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Scene.h"
+#include "Bvh.h"
+#include "MappedFile.h"
+
+// Change this when triangle, triangleAttributes, vertexAttributes, bvhNode,
+// or the BVH builder change, so that old cache files are not used
+#define MESH_CACHE_VERSION 2
+
+// The pools of a mesh that BuildMesh made
+struct MeshPools
+{
+	std::vector<triangle> triangles;
+	std::vector<triangleAttributes> attributes;
+	std::vector<glm::vec4> vertices;
+	std::vector<vertexAttributes> vertexAttribs;
+	std::vector<bvhNode> nodes;
+};
+
+// One mesh in pools of its own, so every index in it starts from 0.
+// main.cpp adds it to the end of the pools of the scene
+struct MeshData
+{
+	int numTriangles = 0;	// of triangles and attributes
+	int numVertices = 0;	// of vertices and vertexAttribs
+	int numNodes = 0;
+
+	const triangle* triangles = nullptr;
+	const triangleAttributes* attributes = nullptr;
+	const glm::vec4* vertices = nullptr;
+	const vertexAttributes* vertexAttribs = nullptr;
+	const bvhNode* nodes = nullptr;
+
+	// The pointers point into one of these. A mesh that is read
+	// from its cache file keeps the file mapped, until it is added
+	// to the pools of the scene and FreeMeshData is called
+	MeshPools memory;
+	MappedFile file;
+};
+
+// A triangle with its own copy of each of its points, the way that
+// a model is written by hand, or read from an OBJ. BuildMesh merges
+// the points that are the same
+struct expandedTriangle
+{
+	glm::vec4 pos[3];
+	glm::vec4 uv[3];
+	glm::vec4 normal[3];
+	glm::vec4 color;
+};
+
+// The start of a cache file. After it come numTriangles triangles,
+// numTriangles triangleAttributes, numVertices positions (glm::vec4),
+// numVertices vertexAttributes, and numNodes bvhNodes, with no gaps.
+// The root node is the box around the whole mesh. The file uses the
+// byte order of the machine that wrote it
+struct MeshCacheHeader
+{
+	char magic[4];			// "RTMC"
+	int version;			// MESH_CACHE_VERSION
+	long long sourceSize;	// size of the OBJ file that this was made from
+	long long sourceTime;	// when that OBJ file was last changed
+	int numTriangles;
+	int numVertices;
+	int numNodes;
+	BvhStats stats;
+	int junk[2];			// so the triangles start on 16 bytes
+};
+
+// Where the cache file of the OBJ at path is
+std::string MeshCachePath(const char* path);
+
+// Makes mesh m out of count triangles, in data.memory, which has to be empty.
+// Points with the same position, UV, and normal are merged into one
+// vertex, every triangle gets its face normal, and the BVH is built
+void BuildMesh(Mesh* m, const expandedTriangle* t, int count, MeshData& data, BvhStats& stats);
+
+// Reads the OBJ file at path, and makes mesh m out of it with BuildMesh.
+// Returns false if the file can't be read
+bool BuildObjMesh(const char* path, Mesh* m, MeshData& data, BvhStats& stats);
+
+// Maps the cache file of the OBJ at path, and points data at the pools
+// of mesh m inside it. Returns false if there is no cache file, or if
+// it is old, so the OBJ has to be read instead
+bool ReadMeshCache(const char* path, Mesh* m, MeshData& data, BvhStats& stats);
+
+// Saves the pools of a mesh (data), which was made from the OBJ at
+// path, and what its BVH looks like (stats), in its cache file
+bool WriteMeshCache(const char* path, const MeshData& data, const BvhStats& stats);
+
+// Makes mesh m out of the OBJ at path, from its cache file if it
+// has one, and makes the cache file if it does not
+bool LoadMesh(const char* path, Mesh* m, MeshData& data, BvhStats& stats);
+
+// Frees the pools of the mesh, and unmaps its cache file
+void FreeMeshData(MeshData& data);
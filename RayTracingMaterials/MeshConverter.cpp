@@ -0,0 +1,81 @@
+/*
+Title: Basic Ray Tracer
+File Name: MeshConverter.cpp
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Makes the mesh cache files of OBJ files ahead of time, so that the ray
+// tracer never has to read an OBJ or build a BVH when it starts:
+//
+//   MeshConverter ../Assets/GreenCar14.3Dobj ../Assets/wheel.3Dobj ...
+//
+// Each cache file is saved next to its OBJ, see MeshCache.h. The cache
+// files are always made again, even if they are already up to date
+
+#include <cstdio>
+#include <chrono>
+
+#include "MeshCache.h"
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		printf("Usage: %s file.3Dobj [file.3Dobj ...]\n", argv[0]);
+		return 1;
+	}
+
+	int failed = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		// each file is a mesh on its own, with its own pools
+		Mesh m = {};
+		BvhStats stats;
+		MeshData data;
+
+		if (!BuildObjMesh(argv[i], &m, data, stats))
+		{
+			printf("Can't read file: %s\n", argv[i]);
+			failed++;
+			continue;
+		}
+
+		if (!WriteMeshCache(argv[i], data, stats))
+		{
+			printf("Can't write mesh cache: %s\n", MeshCachePath(argv[i]).c_str());
+			failed++;
+			continue;
+		}
+
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		printf("%s: triangles %d, vertices %d, BVH nodes %d, depth %d, %.1f ms\n",
+			MeshCachePath(argv[i]).c_str(), m.numTriangles, m.numVertices, stats.numNodes, stats.maxDepth, seconds * 1000.0);
+
+		if (stats.numLostTriangles != 0)
+			printf("Error: the BVH loses %d triangles\n", stats.numLostTriangles);
+	}
+
+	return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,366 @@
+/*
+Title: Basic Ray Tracer
+File Name: ObjLoader.cpp
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "ObjLoader.h"
+#include "MappedFile.h"
+
+// Exact powers of ten, a double can hold all of these with no rounding
+static const double powersOf10[] =
+{
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+	1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Reads the file from p to end. Every function moves p past what it reads
+struct ObjScanner
+{
+	const char* p;
+	const char* end;
+
+	static bool isDigit(char c)
+	{
+		return c >= '0' && c <= '9';
+	}
+
+	// Skips spaces and tabs, but not the end of the line
+	void skipSpaces()
+	{
+		while (p < end && (*p == ' ' || *p == '\t'))
+			p++;
+	}
+
+	// Moves to the start of the next line
+	void nextLine()
+	{
+		while (p < end && *p != '\n')
+			p++;
+
+		if (p < end)
+			p++;
+	}
+
+	bool atEndOfLine()
+	{
+		skipSpaces();
+		return p >= end || *p == '\n' || *p == '\r' || *p == '#';
+	}
+
+	// Reads a number like -12, 3.25, .5, or 1.5e-3. All of the digits
+	// are read into one integer, and the decimal point and exponent
+	// only move the power of ten that it is multiplied by at the end
+	bool readFloat(float& value)
+	{
+		skipSpaces();
+
+		bool negative = false;
+
+		if (p < end && (*p == '-' || *p == '+'))
+		{
+			negative = *p == '-';
+			p++;
+		}
+
+		unsigned long long digits = 0;
+		int numDigits = 0;
+		int exponent = 0;
+		bool anyDigits = false;
+
+		while (p < end && isDigit(*p))
+		{
+			// After 19 digits the integer is full, and
+			// the rest of the digits are too small to matter
+			if (numDigits < 19)
+			{
+				digits = digits * 10 + (*p - '0');
+				if (digits != 0) numDigits++;
+			}
+			else
+				exponent++;
+
+			anyDigits = true;
+			p++;
+		}
+
+		if (p < end && *p == '.')
+		{
+			p++;
+
+			while (p < end && isDigit(*p))
+			{
+				if (numDigits < 19)
+				{
+					digits = digits * 10 + (*p - '0');
+					if (digits != 0) numDigits++;
+					exponent--;
+				}
+
+				anyDigits = true;
+				p++;
+			}
+		}
+
+		if (!anyDigits)
+			return false;
+
+		if (p < end && (*p == 'e' || *p == 'E'))
+		{
+			p++;
+
+			bool negativeExponent = false;
+
+			if (p < end && (*p == '-' || *p == '+'))
+			{
+				negativeExponent = *p == '-';
+				p++;
+			}
+
+			int e = 0;
+
+			while (p < end && isDigit(*p))
+			{
+				if (e < 10000)
+					e = e * 10 + (*p - '0');
+				p++;
+			}
+
+			exponent += negativeExponent ? -e : e;
+		}
+
+		double result = (double)digits;
+
+		// Numbers in OBJ files are almost never this
+		// big or small, so this loop rarely runs more than once
+		while (exponent > 22)
+		{
+			result *= 1e22;
+			exponent -= 22;
+		}
+
+		while (exponent < -22)
+		{
+			result /= 1e22;
+			exponent += 22;
+		}
+
+		if (exponent >= 0)
+			result *= powersOf10[exponent];
+		else
+			result /= powersOf10[-exponent];
+
+		value = (float)(negative ? -result : result);
+		return true;
+	}
+
+	// Reads a whole number, which can be negative
+	bool readInt(int& value)
+	{
+		bool negative = false;
+
+		if (p < end && (*p == '-' || *p == '+'))
+		{
+			negative = *p == '-';
+			p++;
+		}
+
+		if (p >= end || !isDigit(*p))
+			return false;
+
+		long long result = 0;
+
+		while (p < end && isDigit(*p))
+		{
+			if (result < 0x7FFFFFFF)
+				result = result * 10 + (*p - '0');
+			p++;
+		}
+
+		if (result > 0x7FFFFFFF)
+			result = 0x7FFFFFFF;
+
+		value = (int)(negative ? -result : result);
+		return true;
+	}
+
+	// Is the word at p the keyword, followed by a space?
+	bool readKeyword(const char* keyword)
+	{
+		const char* q = p;
+
+		while (*keyword != 0)
+		{
+			if (q >= end || *q != *keyword)
+				return false;
+
+			q++;
+			keyword++;
+		}
+
+		if (q >= end || (*q != ' ' && *q != '\t'))
+			return false;
+
+		p = q;
+		return true;
+	}
+};
+
+// OBJ indices start at 1, and negative indices count back from
+// the end of the list. Returns the index from 0, or -1 if it is
+// not in the list
+static int ResolveIndex(int index, int count)
+{
+	if (index > 0)
+		return index <= count ? index - 1 : -1;
+
+	if (index < 0)
+		return count + index >= 0 ? count + index : -1;
+
+	return -1;
+}
+
+// Reads one corner of a face, like 5, 5/2, 5//3, or 5/2/3
+static bool ReadCorner(ObjScanner& s, const ObjData& obj, ObjCorner& corner, bool& bad)
+{
+	s.skipSpaces();
+
+	int index;
+
+	if (!s.readInt(index))
+		return false;
+
+	corner.position = ResolveIndex(index, (int)obj.positions.size());
+	corner.uv = -1;
+	corner.normal = -1;
+
+	if (corner.position == -1)
+		bad = true;
+
+	if (s.p < s.end && *s.p == '/')
+	{
+		s.p++;
+
+		// v//vn has no UV
+		if (s.readInt(index))
+		{
+			corner.uv = ResolveIndex(index, (int)obj.uvs.size());
+
+			if (corner.uv == -1)
+				bad = true;
+		}
+
+		if (s.p < s.end && *s.p == '/')
+		{
+			s.p++;
+
+			if (s.readInt(index))
+			{
+				corner.normal = ResolveIndex(index, (int)obj.normals.size());
+
+				if (corner.normal == -1)
+					bad = true;
+			}
+		}
+	}
+
+	return true;
+}
+
+bool LoadObjFile(const char* path, ObjData& obj, int& badFaces)
+{
+	obj = ObjData();
+	badFaces = 0;
+
+	MappedFile file;
+
+	if (!OpenMappedFile(path, file))
+		return false;
+
+	ObjScanner s;
+	s.p = file.data;
+	s.end = file.data + file.size;
+
+	// The corners of the face that is being read
+	std::vector<ObjCorner> face;
+
+	while (s.p < s.end)
+	{
+		s.skipSpaces();
+
+		if (s.readKeyword("v"))
+		{
+			glm::vec3 v;
+
+			if (s.readFloat(v.x) && s.readFloat(v.y) && s.readFloat(v.z))
+				obj.positions.push_back(v);
+		}
+
+		else if (s.readKeyword("vt"))
+		{
+			// the third value (w) is never used
+			glm::vec2 uv;
+
+			if (s.readFloat(uv.x) && s.readFloat(uv.y))
+				obj.uvs.push_back(uv);
+		}
+
+		else if (s.readKeyword("vn"))
+		{
+			glm::vec3 n;
+
+			if (s.readFloat(n.x) && s.readFloat(n.y) && s.readFloat(n.z))
+				obj.normals.push_back(n);
+		}
+
+		else if (s.readKeyword("f"))
+		{
+			face.clear();
+			bool bad = false;
+			ObjCorner corner;
+
+			while (!s.atEndOfLine() && ReadCorner(s, obj, corner, bad))
+				face.push_back(corner);
+
+			if (bad || face.size() < 3)
+				badFaces++;
+
+			// Split the face into a fan of triangles,
+			// a quad 0 1 2 3 becomes 0 1 2 and 0 2 3
+			else
+			{
+				for (size_t i = 2; i < face.size(); i++)
+				{
+					obj.corners.push_back(face[0]);
+					obj.corners.push_back(face[i - 1]);
+					obj.corners.push_back(face[i]);
+				}
+			}
+		}
+
+		// Anything else (comments, objects, groups, materials) is skipped
+		s.nextLine();
+	}
+
+	CloseMappedFile(file);
+	return true;
+}
@@ -0,0 +1,60 @@
+/*
+Title: Basic Ray Tracer
+File Name: ObjLoader.h
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Reads Wavefront OBJ files. The file is memory mapped and read with our own
+// number scanner, one byte at a time, with no sscanf, and no limit on the
+// length of a line. Indices are 32-bit, so meshes can have any number of
+// vertices. Faces can be written as v, v/vt, v//vn, or v/vt/vn, and
+// faces with more than three corners (like quads) are split into triangles
+
+#pragma once
+
+#include <vector>
+
+#include "glm/glm.hpp"
+
+// One corner of a triangle, with indices into the lists of
+// positions, UVs, and normals. A corner with no UV or no normal
+// in the file has -1 there
+struct ObjCorner
+{
+	int position;
+	int uv;
+	int normal;
+};
+
+// Everything that we read from an OBJ file
+struct ObjData
+{
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec2> uvs;
+	std::vector<glm::vec3> normals;
+	std::vector<ObjCorner> corners; // three for every triangle
+};
+
+// Reads the OBJ file at path into obj. Returns false if the file can't be
+// opened. Faces that use an index that is not in the file are skipped,
+// and counted in badFaces
+bool LoadObjFile(const char* path, ObjData& obj, int& badFaces);
@@ -0,0 +1,118 @@
+/*
+Title: Basic Ray Tracer
+File Name: Quantize.cpp
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <cstring>
+#include <map>
+
+#include "glm/gtc/packing.hpp"
+
+#include "Quantize.h"
+
+// -1 or 1, but never 0, so the fold works on the axes too
+static glm::vec2 SignNotZero(glm::vec2 v)
+{
+	return glm::vec2(v.x >= 0.0f ? 1.0f : -1.0f, v.y >= 0.0f ? 1.0f : -1.0f);
+}
+
+unsigned int PackNormal(glm::vec3 normal)
+{
+	float sum = glm::abs(normal.x) + glm::abs(normal.y) + glm::abs(normal.z);
+
+	// a normal of 0 can't be packed, it comes back as +z
+	if (sum == 0.0f)
+		return glm::packSnorm2x16(glm::vec2(0));
+
+	// onto the octahedron
+	glm::vec3 n = normal / sum;
+	glm::vec2 p = glm::vec2(n);
+
+	// fold the bottom half out
+	if (n.z < 0.0f)
+		p = (1.0f - glm::abs(glm::vec2(p.y, p.x))) * SignNotZero(p);
+
+	return glm::packSnorm2x16(p);
+}
+
+glm::vec3 UnpackNormal(unsigned int normal)
+{
+	glm::vec2 p = glm::unpackSnorm2x16(normal);
+	glm::vec3 n = glm::vec3(p, 1.0f - glm::abs(p.x) - glm::abs(p.y));
+
+	// fold the bottom half back in
+	if (n.z < 0.0f)
+	{
+		glm::vec2 folded = (1.0f - glm::abs(glm::vec2(n.y, n.x))) * SignNotZero(p);
+		n.x = folded.x;
+		n.y = folded.y;
+	}
+
+	return glm::normalize(n);
+}
+
+unsigned int PackUV(glm::vec2 uv)
+{
+	return glm::packHalf2x16(uv);
+}
+
+glm::vec2 UnpackUV(unsigned int uv)
+{
+	return glm::unpackHalf2x16(uv);
+}
+
+// Compares colors bit by bit, for the map of colors in the palette
+struct ColorLess
+{
+	bool operator()(const glm::vec4& a, const glm::vec4& b) const
+	{
+		return memcmp(&a, &b, sizeof(glm::vec4)) < 0;
+	}
+};
+
+void QuantizeAttributes(const std::vector<vertexAttributes>& vertexAttribs, const std::vector<triangleAttributes>& attributes,
+	std::vector<triangle>& triangles, std::vector<packedVertexAttributes>& packed, std::vector<glm::vec4>& palette)
+{
+	packed.resize(vertexAttribs.size());
+
+	for (size_t i = 0; i < vertexAttribs.size(); i++)
+	{
+		packed[i].normal = PackNormal(glm::vec3(vertexAttribs[i].normal));
+		packed[i].uv = PackUV(glm::vec2(vertexAttribs[i].uv));
+	}
+
+	// A scene only has a few colors, so the
+	// palette is tiny, no matter how many triangles
+	std::map<glm::vec4, int, ColorLess> colorIndex;
+	palette.clear();
+
+	for (size_t i = 0; i < triangles.size(); i++)
+	{
+		std::pair<std::map<glm::vec4, int, ColorLess>::iterator, bool> found =
+			colorIndex.insert(std::make_pair(attributes[i].color, (int)palette.size()));
+
+		if (found.second)
+			palette.push_back(attributes[i].color);
+
+		triangles[i].color = found.first->second;
+	}
+}
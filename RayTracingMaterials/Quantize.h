@@ -0,0 +1,53 @@
+/*
+Title: Basic Ray Tracer
+File Name: Quantize.h
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// The compact form of the UVs, normals, and colors, used with --quantize.
+// A vertexAttributes is 32 bytes, with a float for every number and a lot
+// of unused w, but a normal only needs two 16 bit numbers, and a UV only
+// needs two half floats, so packedVertexAttributes is 8 bytes. The colors
+// of the triangles are put in a palette, which only has each color once,
+// and each triangle keeps the index of its color in triangle.color
+//
+// A normal is packed with the octahedral encoding: the sphere of directions
+// is pressed into an octahedron (|x| + |y| + |z| = 1), and the bottom half
+// of the octahedron is folded out over the corners of the top half, which
+// makes a square of x and y from -1 to 1. The shaders unpack them with
+// unpackSnorm2x16 and unpackHalf2x16, see FragmentShader.glsl
+
+#pragma once
+
+#include <vector>
+
+#include "Scene.h"
+
+// Packs every vertex attribute into packed, and every triangle color into
+// palette, and gives every triangle the index of its color
+void QuantizeAttributes(const std::vector<vertexAttributes>& vertexAttribs, const std::vector<triangleAttributes>& attributes,
+	std::vector<triangle>& triangles, std::vector<packedVertexAttributes>& packed, std::vector<glm::vec4>& palette);
+
+unsigned int PackNormal(glm::vec3 normal);
+glm::vec3 UnpackNormal(unsigned int normal);
+
+unsigned int PackUV(glm::vec2 uv);
+glm::vec2 UnpackUV(unsigned int uv);
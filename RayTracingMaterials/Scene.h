@@ -0,0 +1,146 @@
+/*
+Title: Basic Ray Tracer
+File Name: Scene.h
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// The scene data that is shared between the C++ code, the shaders, and the
+// CPU tracer. These structs must match the structs in Compute.glsl and
+// FragmentShader.glsl exactly, because they are copied straight into buffers
+
+// The triangles of every mesh are packed together, one mesh after another,
+// in one big triangle pool. A Mesh does not hold its triangles, it only
+// says where they start in the pool, and how many there are. The same is
+// done for the BVH nodes of every mesh, in the node pool. This way, the
+// buffers are only as big as the scene, and a model of any size can be loaded
+
+// The triangles and BVH of a mesh never move, they stay in object space.
+// A mesh is put into the world by an instance, which has a matrix, and
+// the texture and ray tracing properties of that copy. Many instances can
+// use the same mesh (like the four wheels of the car), and the triangles
+// and BVH of that mesh are still only in the pools once. Every frame, we
+// only make a small BVH over the boxes of the instances in the world
+// (the top level BVH), and a ray that reaches an instance is moved
+// into the object space of its mesh, with the inverse of its matrix
+
+// The points of the triangles are in the vertex pool, and each triangle
+// only has the indices of its three points. A point that is shared by
+// many triangles (with the same position, UV, and normal) is stored once,
+// instead of once for every triangle that uses it. The positions are
+// read by every ray, so they have a pool of their own, and many of them
+// fit in the cache. The UVs and normals are only read for the one
+// triangle that a ray hits, so they are in a separate pool, with the
+// same index as the position. The color of each triangle is in the
+// attribute pool, with the same index as the triangle
+
+#pragma once
+
+#include "glm/glm.hpp"
+
+// There is no limit on the number of meshes, instances, lights, or
+// textures. main.cpp counts them when it builds the scene, and makes
+// every buffer as big as it needs to be
+
+#define BVH_STACK_SIZE 32 // rays keep a stack of nodes to visit, so a BVH can be 31 levels deep
+
+// xyz of faceNormal is the face normal, so a ray can skip triangles
+// that face away without reading any points. v has the three points,
+// in the vertex pool, counted from the first vertex of the mesh
+struct triangle {
+	glm::vec4 faceNormal;
+	int v[3];
+	int color;	// with --quantize, the index of the color in the palette
+};
+
+struct triangleAttributes {
+	glm::vec4 color;
+};
+
+// The positions of the points are a glm::vec4 each (w is 1),
+// this is the rest of each point
+struct vertexAttributes {
+	glm::vec4 normal;
+	glm::vec4 uv;
+};
+
+// The same as vertexAttributes, in 8 bytes instead of 32, used with
+// --quantize. See Quantize.h for how the numbers are packed
+struct packedVertexAttributes {
+	unsigned int normal;	// octahedral, two 16 bit numbers
+	unsigned int uv;		// two half floats
+};
+
+// One box of a bounding volume hierarchy (BVH), see Bvh.cpp.
+// An inner node has two children, which are always next to each
+// other in the node pool. A leaf node has a range of triangles,
+// the triangles of every leaf are next to each other in the pool.
+// Both indices start from the first node and triangle of the mesh.
+// The top level BVH uses the same nodes, but its leaves have
+// a range of the top level instance list instead of triangles
+struct bvhNode
+{
+	glm::vec4 min;
+	glm::vec4 max;
+
+	int firstChild;		// inner node: index of the left child, the right child is next
+	int firstTriangle;	// leaf node: index of the first triangle
+	int numTriangles;	// 0 for inner nodes
+	int junk;
+};
+
+struct Mesh
+{
+	int numTriangles;
+	int firstTriangle;	// where this mesh's triangles start in the triangle pool
+	int numNodes;
+	int firstNode;		// where this mesh's BVH starts in the node pool, the root is first
+	int numVertices;
+	int firstVertex;	// where this mesh's points start in the vertex pools
+};
+
+// One copy of a mesh in the world. The matrices are written by
+// Compute.glsl every frame, the rest is set once in initScene
+struct instance
+{
+	glm::mat4x4 objectToWorld;	// the model matrix
+	glm::mat4x4 worldToObject;	// the inverse, to move rays into object space
+
+	int mesh;			// which mesh this is a copy of
+	int texture;		// which texture it uses, and its layer in the texture array
+	int boolUseEffects;
+	int reflectionLevel;
+
+	// How much of its layer in the texture array one copy of the
+	// texture covers, the UVs are multiplied by this. The CPU tracer
+	// has each texture on its own, so it does not use this
+	glm::vec2 uvScale;
+	int junk[2];
+};
+
+struct light {
+	glm::vec4 pos;
+	glm::vec4 color;
+	float radius;
+	float brightness;
+	float junk1;
+	float junk2;
+};
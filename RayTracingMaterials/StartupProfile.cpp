@@ -0,0 +1,153 @@
+/*
+Title: Basic Ray Tracer
+File Name: StartupProfile.cpp
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+#include "StartupProfile.h"
+
+struct StartupPhase
+{
+	std::string name;
+	int thread;
+	double start;		// seconds since the program started
+	double seconds;		// wall time
+	long long bytes;	// 0 if it has no bytes to count
+};
+
+static std::vector<StartupPhase> phases;
+static std::mutex phaseLock;
+
+static thread_local int profileThread = 0;
+
+double ProfileTime()
+{
+	static std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+void SetProfileThread(int thread)
+{
+	profileThread = thread;
+}
+
+void AddStartupPhase(const std::string& name, double start, long long bytes)
+{
+	StartupPhase p;
+	p.name = name;
+	p.thread = profileThread;
+	p.start = start;
+	p.seconds = ProfileTime() - start;
+	p.bytes = bytes;
+
+	std::lock_guard<std::mutex> lock(phaseLock);
+	phases.push_back(p);
+}
+
+// The workers add their phases when they finish, not when they start
+static std::vector<StartupPhase> SortedPhases()
+{
+	std::lock_guard<std::mutex> lock(phaseLock);
+	std::vector<StartupPhase> sorted = phases;
+
+	std::stable_sort(sorted.begin(), sorted.end(),
+		[](const StartupPhase& a, const StartupPhase& b) { return a.start < b.start; });
+
+	return sorted;
+}
+
+// Megabytes per second, 0 for a phase with no bytes, or no time
+static double Throughput(const StartupPhase& p)
+{
+	if (p.bytes == 0 || p.seconds <= 0.0)
+		return 0.0;
+
+	return p.bytes / p.seconds / (1024.0 * 1024.0);
+}
+
+void PrintStartupProfile()
+{
+	std::vector<StartupPhase> sorted = SortedPhases();
+
+	printf("\n%-56s %6s %10s %10s %12s %10s\n", "startup phase", "thread", "start ms", "ms", "bytes", "MB/s");
+
+	for (size_t i = 0; i < sorted.size(); i++)
+	{
+		const StartupPhase& p = sorted[i];
+
+		printf("%-56s %6d %10.1f %10.2f %12lld %10.1f\n",
+			p.name.c_str(), p.thread, p.start * 1000.0, p.seconds * 1000.0, p.bytes, Throughput(p));
+	}
+
+	printf("%-56s %6s %10s %10.1f\n\n", "total", "", "", ProfileTime() * 1000.0);
+}
+
+// The names are file paths, which can have \ on Windows
+static void WriteJsonString(FILE* f, const std::string& s)
+{
+	fputc('"', f);
+
+	for (size_t i = 0; i < s.size(); i++)
+	{
+		if (s[i] == '"' || s[i] == '\\')
+			fputc('\\', f);
+
+		fputc(s[i], f);
+	}
+
+	fputc('"', f);
+}
+
+bool WriteStartupProfile(const char* path)
+{
+	std::vector<StartupPhase> sorted = SortedPhases();
+
+	FILE* json = fopen(path, "w");
+
+	if (json == nullptr)
+		return false;
+
+	fprintf(json, "{\n");
+	fprintf(json, "\t\"total\": %.6f,\n", ProfileTime());
+	fprintf(json, "\t\"phases\": [\n");
+
+	for (size_t i = 0; i < sorted.size(); i++)
+	{
+		const StartupPhase& p = sorted[i];
+
+		fprintf(json, "\t\t{ \"name\": ");
+		WriteJsonString(json, p.name);
+		fprintf(json, ", \"thread\": %d, \"start\": %.6f, \"seconds\": %.6f, \"bytes\": %lld }%s\n",
+			p.thread, p.start, p.seconds, p.bytes, i + 1 < sorted.size() ? "," : "");
+	}
+
+	fprintf(json, "\t]\n");
+	fprintf(json, "}\n");
+
+	return fclose(json) == 0;
+}
@@ -0,0 +1,56 @@
+/*
+Title: Basic Ray Tracer
+File Name: StartupProfile.h
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Times the steps of the startup (making the OpenGL context, compiling
+// the shaders, loading each texture and mesh, uploading the buffers), so
+// that we can see which one makes the first frame late. Each step is a
+// phase, with its wall time and how many bytes it read, made, or gave to
+// OpenGL. The asset workers add phases too, at the same time as the main
+// thread, so the phases can overlap, and the thread of each one is kept.
+// main.cpp prints the phases after the first frame, and writes them
+// to startup.json, so that the startup of two builds can be compared
+
+#pragma once
+
+#include <string>
+
+// Seconds since the program started. Every phase, and every
+// time that main.cpp measures, is on this clock
+double ProfileTime();
+
+// The thread number of the phases that this thread adds,
+// 0 is the main thread, and the asset workers start at 1
+void SetProfileThread(int thread);
+
+// Adds a phase that started at start (a ProfileTime) and ends now.
+// Any thread can call this
+void AddStartupPhase(const std::string& name, double start, long long bytes);
+
+// Prints every phase in the order they started, with the
+// total time from when the program started until now
+void PrintStartupProfile();
+
+// Writes the same thing as PrintStartupProfile, as JSON.
+// Returns false if the file can't be written
+bool WriteStartupProfile(const char* path);
@@ -0,0 +1,329 @@
+/*
+Title: Basic Ray Tracer
+File Name: TextureCache.cpp
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include <cstdio>
+#include <cstring>
+
+#include "FreeImage.h"
+
+#include "TextureCache.h"
+#include "StartupProfile.h"
+
+std::string TextureCachePath(const char* path)
+{
+	return std::string(path) + ".rttex";
+}
+
+int TextureLevelWidth(int width, int level)
+{
+	int w = width >> level;
+	return w > 0 ? w : 1;
+}
+
+size_t TextureLevelOffset(int width, int height, int level)
+{
+	size_t offset = 0;
+
+	for (int i = 0; i < level; i++)
+		offset += 4 * (size_t)TextureLevelWidth(width, i) * TextureLevelWidth(height, i);
+
+	return offset;
+}
+
+// The number of levels down to 1x1, the same as glGenerateMipmap makes
+static int CountLevels(int width, int height)
+{
+	int levels = 1;
+
+	while (TextureLevelWidth(width, levels - 1) > 1 || TextureLevelWidth(height, levels - 1) > 1)
+		levels++;
+
+	return levels;
+}
+
+// FNV-1a, over every byte of the image file. It only needs to tell
+// one version of an image from another, not to be secure
+static unsigned long long HashBytes(const char* data, size_t size)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= (unsigned char)data[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+// Where a pixel of the smaller level samples the bigger level. The
+// sample is at the center of the pixel, which is between two pixels of the
+// bigger level, so i0 and i1 are those two pixels, and weight is how much
+// of i1 is used. When the size halves exactly, the weight is always 0.5
+static void MipmapSample(int dst, int srcSize, int dstSize, int& i0, int& i1, float& weight)
+{
+	float s = (dst + 0.5f) * srcSize / dstSize - 0.5f;
+
+	if (s < 0.0f)
+		s = 0.0f;
+
+	i0 = (int)s;
+	i1 = i0 + 1 < srcSize ? i0 + 1 : srcSize - 1;
+	weight = s - i0;
+}
+
+// Makes the dstWidth by dstHeight image dst out of src, each pixel samples
+// src at its center, with bilinear filtering
+static void ResampleImage(const unsigned char* src, int srcWidth, int srcHeight, unsigned char* dst, int dstWidth, int dstHeight)
+{
+	for (int y = 0; y < dstHeight; y++)
+	{
+		int y0, y1;
+		float ty;
+		MipmapSample(y, srcHeight, dstHeight, y0, y1, ty);
+
+		for (int x = 0; x < dstWidth; x++)
+		{
+			int x0, x1;
+			float tx;
+			MipmapSample(x, srcWidth, dstWidth, x0, x1, tx);
+
+			const unsigned char* p00 = &src[4 * ((size_t)y0 * srcWidth + x0)];
+			const unsigned char* p10 = &src[4 * ((size_t)y0 * srcWidth + x1)];
+			const unsigned char* p01 = &src[4 * ((size_t)y1 * srcWidth + x0)];
+			const unsigned char* p11 = &src[4 * ((size_t)y1 * srcWidth + x1)];
+
+			unsigned char* out = &dst[4 * ((size_t)y * dstWidth + x)];
+
+			// + 0.5 rounds to the nearest value
+			for (int c = 0; c < 4; c++)
+			{
+				float top = p00[c] + (p10[c] - p00[c]) * tx;
+				float bottom = p01[c] + (p11[c] - p01[c]) * tx;
+				out[c] = (unsigned char)(top + (bottom - top) * ty + 0.5f);
+			}
+		}
+	}
+}
+
+// Makes every level after level 0 out of the level before it, the same way
+// that glGenerateMipmap does: each pixel samples the bigger level at its
+// center, with bilinear filtering. When the size halves exactly (a power of
+// two), this is the average of 2x2 pixels. When a level has an odd size
+// (like 117), the pixels are not exactly 2x2, so the weights change a little
+static void BuildMipmaps(TextureData& data)
+{
+	for (int level = 1; level < data.numLevels; level++)
+	{
+		ResampleImage(&data.memory[TextureLevelOffset(data.width, data.height, level - 1)],
+			TextureLevelWidth(data.width, level - 1), TextureLevelWidth(data.height, level - 1),
+			&data.memory[TextureLevelOffset(data.width, data.height, level)],
+			TextureLevelWidth(data.width, level), TextureLevelWidth(data.height, level));
+	}
+}
+
+// Decodes the image file that is mapped in source, converts it to
+// 32 bits, and makes its mipmaps
+static bool DecodeTexture(const MappedFile& source, TextureData& data)
+{
+	// FreeImage reads the mapped file, so the image is only read from the disk once
+	FIMEMORY* memory = FreeImage_OpenMemory((BYTE*)source.data, (DWORD)source.size);
+	FIBITMAP* bitmap = FreeImage_LoadFromMemory(FreeImage_GetFileTypeFromMemory(memory, 0), memory, 0);
+	FreeImage_CloseMemory(memory);
+
+	if (bitmap == nullptr)
+		return false;
+
+	// Convert the file to 32 bits so we can use it.
+	FIBITMAP* bitmap32 = FreeImage_ConvertTo32Bits(bitmap);
+	FreeImage_Unload(bitmap);
+
+	if (bitmap32 == nullptr)
+		return false;
+
+	data.width = FreeImage_GetWidth(bitmap32);
+	data.height = FreeImage_GetHeight(bitmap32);
+	data.numLevels = CountLevels(data.width, data.height);
+	data.memory.resize(TextureLevelOffset(data.width, data.height, data.numLevels));
+
+	// FreeImage can pad the end of each row, so the rows are copied one at a time
+	for (int y = 0; y < data.height; y++)
+		memcpy(&data.memory[4 * (size_t)y * data.width], FreeImage_GetScanLine(bitmap32, y), 4 * (size_t)data.width);
+
+	FreeImage_Unload(bitmap32);
+
+	BuildMipmaps(data);
+	data.pixels = data.memory.data();
+	return true;
+}
+
+// How many bytes every level of a texture takes
+static long long TextureDataBytes(const TextureData& data)
+{
+	return (long long)TextureLevelOffset(data.width, data.height, data.numLevels);
+}
+
+// Maps the cache file of the image at path, if it was made from an image
+// with this hash and size. The pixels are used straight out of the mapping
+static bool ReadTextureCache(const char* path, unsigned long long sourceHash, long long sourceSize, TextureData& data)
+{
+	MappedFile file;
+
+	if (!OpenMappedFile(TextureCachePath(path).c_str(), file))
+		return false;
+
+	// The header has to match this program and this image, and the
+	// file has to be long enough for every level, or it was only partly written
+	const TextureCacheHeader* header = (const TextureCacheHeader*)file.data;
+	bool valid = file.size >= sizeof(TextureCacheHeader) &&
+		memcmp(header->magic, "RTTC", 4) == 0 &&
+		header->version == TEXTURE_CACHE_VERSION &&
+		header->sourceHash == sourceHash &&
+		header->sourceSize == sourceSize &&
+		header->width > 0 && header->height > 0 &&
+		header->numLevels == CountLevels(header->width, header->height) &&
+		file.size == sizeof(TextureCacheHeader) + TextureLevelOffset(header->width, header->height, header->numLevels);
+
+	if (!valid)
+	{
+		CloseMappedFile(file);
+		return false;
+	}
+
+	data.width = header->width;
+	data.height = header->height;
+	data.numLevels = header->numLevels;
+	data.pixels = (const unsigned char*)(header + 1);
+	data.file = file;
+	return true;
+}
+
+// Saves the texture in data, which was decoded from an image
+// with this hash and size, in the cache file of the image at path
+static bool WriteTextureCache(const char* path, unsigned long long sourceHash, long long sourceSize, const TextureData& data)
+{
+	TextureCacheHeader header = {};
+	memcpy(header.magic, "RTTC", 4);
+	header.version = TEXTURE_CACHE_VERSION;
+	header.sourceHash = sourceHash;
+	header.sourceSize = sourceSize;
+	header.width = data.width;
+	header.height = data.height;
+	header.numLevels = data.numLevels;
+
+	// written next to the cache file, and then renamed over
+	// it, see TempFilePath
+	std::string cachePath = TextureCachePath(path);
+	std::string tempPath = TempFilePath(cachePath.c_str());
+	FILE* f = fopen(tempPath.c_str(), "wb");
+
+	if (f == NULL)
+		return false;
+
+	size_t size = TextureLevelOffset(data.width, data.height, data.numLevels);
+
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+		fwrite(data.pixels, 1, size, f) == size;
+
+	ok = fclose(f) == 0 && ok;
+
+	// don't leave half a file behind, if the disk is full
+	if (!ok)
+		remove(tempPath.c_str());
+	else
+		ok = RenameOverFile(tempPath.c_str(), cachePath.c_str());
+
+	return ok;
+}
+
+bool LoadTextureData(const char* path, TextureData& data)
+{
+	MappedFile source;
+
+	double start = ProfileTime();
+
+	if (!OpenMappedFile(path, source))
+		return false;
+
+	// Hashing the image is much faster than decoding it
+	unsigned long long sourceHash = HashBytes(source.data, source.size);
+	long long sourceSize = (long long)source.size;
+
+	if (ReadTextureCache(path, sourceHash, sourceSize, data))
+	{
+		// the image is read once to hash it, the cache file is only mapped
+		AddStartupPhase(std::string("hash and map texture cache ") + path, start, sourceSize);
+
+		CloseMappedFile(source);
+		return true;
+	}
+
+	bool decoded = DecodeTexture(source, data);
+	CloseMappedFile(source);
+
+	if (!decoded)
+		return false;
+
+	AddStartupPhase(std::string("decode and mipmap ") + path, start, sourceSize);
+
+	// The Assets folder might be read only, then
+	// we just decode the image again next time
+	double writeStart = ProfileTime();
+
+	if (!WriteTextureCache(path, sourceHash, sourceSize, data))
+		printf("Can't write texture cache: %s\n", TextureCachePath(path).c_str());
+	else
+		AddStartupPhase(std::string("write texture cache ") + path, writeStart, sizeof(TextureCacheHeader) + TextureDataBytes(data));
+
+	return true;
+}
+
+void ResizeTextureData(TextureData& data, int width, int height)
+{
+	if (width == data.width && height == data.height)
+		return;
+
+	TextureData resized;
+	resized.width = width;
+	resized.height = height;
+	resized.numLevels = CountLevels(width, height);
+	resized.memory.resize(TextureLevelOffset(width, height, resized.numLevels));
+
+	ResampleImage(data.pixels, data.width, data.height, resized.memory.data(), width, height);
+	BuildMipmaps(resized);
+
+	FreeTextureData(data);
+	data.width = resized.width;
+	data.height = resized.height;
+	data.numLevels = resized.numLevels;
+	data.memory.swap(resized.memory);
+	data.pixels = data.memory.data();
+}
+
+void FreeTextureData(TextureData& data)
+{
+	CloseMappedFile(data.file);
+	data = TextureData();
+}
@@ -0,0 +1,94 @@
+/*
+Title: Basic Ray Tracer
+File Name: TextureCache.h
+Copyright � 2019
+Original authors: Niko Procopi
+Written under the supervision of David I. Schwartz, Ph.D., and
+supported by a professional development seed grant from the B. Thomas
+Golisano College of Computing & Information Sciences
+(https://www.rit.edu/gccis) at the Rochester Institute of Technology.
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+// Decodes PNG and JPG textures, and makes their mipmaps, and saves the
+// result in a binary cache file next to the image. The next time the
+// program starts, the cache file is memory mapped, and the mipmaps are
+// given to OpenGL straight out of the mapping, so there is no decode,
+// no conversion to 32 bits, and no glGenerateMipmap. The cache is made
+// again if the bytes of the image change (its hash is in the cache), or
+// if the layout of the data changes (TEXTURE_CACHE_VERSION)
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "MappedFile.h"
+
+// Change this when the pixel layout or the mipmap filter change,
+// so that old cache files are not used
+#define TEXTURE_CACHE_VERSION 1
+
+// A texture with every level of its mipmap chain. Each level is 32 bit
+// BGRA, bottom row first, like FreeImage gives us, and half as wide and
+// high as the level before it (but at least 1). The levels are one after
+// another in pixels, level 0 first
+struct TextureData
+{
+	int width = 0;
+	int height = 0;
+	int numLevels = 0;
+	const unsigned char* pixels = nullptr;
+
+	// pixels points into one of these. The cache file stays
+	// mapped until the texture is given to OpenGL
+	std::vector<unsigned char> memory;
+	MappedFile file;
+};
+
+// The start of a cache file. After it come the pixels of every level
+struct TextureCacheHeader
+{
+	char magic[4];				// "RTTC"
+	int version;				// TEXTURE_CACHE_VERSION
+	unsigned long long sourceHash;	// FNV-1a hash of every byte of the image file
+	long long sourceSize;		// size of the image file
+	int width;
+	int height;
+	int numLevels;
+	int junk;
+};
+
+// Where the cache file of the image at path is
+std::string TextureCachePath(const char* path);
+
+// The size of level of a texture that is width by height at level 0,
+// and where that level starts in TextureData::pixels
+int TextureLevelWidth(int width, int level);
+size_t TextureLevelOffset(int width, int height, int level);
+
+// Reads the image at path into data, from its cache file if the image has
+// not changed, otherwise by decoding it, and then makes the cache file.
+// Returns false if the image can't be read
+bool LoadTextureData(const char* path, TextureData& data);
+
+// Stretches level 0 of data to width by height, with bilinear filtering,
+// and makes its mipmaps again. The result is only in memory, the
+// cache file keeps the size of the image
+void ResizeTextureData(TextureData& data, int width, int height);
+
+// Frees the pixels, and unmaps the cache file
+void FreeTextureData(TextureData& data);
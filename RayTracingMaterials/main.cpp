@@ -27,85 +27,174 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <string>
 #include <fstream>
 #include <vector>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <cfloat>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#ifdef _WIN32
 #include <windows.h>
-#include <time.h>
+#else
+#include <sys/stat.h>
+#endif
 
 #include "GL/glew.h"
+
+// HEADLESS_RENDER builds the offline renderer for machines without
+// a display. Instead of a GLFW window, we create an OpenGL context
+// with EGL, and render every frame into a framebuffer object
+#ifdef HEADLESS_RENDER
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#else
 #include "GLFW/glfw3.h"
+#endif
+
 #include "glm/glm.hpp"
 #include "glm/gtc/matrix_transform.hpp"
 #include "glm/gtc/type_ptr.hpp"
 #include "FreeImage.h"
 
-#define MAX_LIGHTS 5
-#define MAX_TEXTURES 5
-#define MAX_MESHES 10
-#define MAX_TRIANGLES_PER_MESH 1486 // biggest mesh is 1486 triangles
-#define NUM_TRIANGLES_IN_SCENE 4462 // This is calculated in the console window
-#define MAX_TRIANGLES_PER_CHUNK 400 // We dont use 400, but this gives room for more
-
-struct triangle {
-	glm::vec4 pos[3];
-	glm::vec4 uv[3];
-	glm::vec4 normal[3];
-	glm::vec4 color;
-};
-
-struct chunk
-{
-	glm::vec4 min;
-	glm::vec4 max;
-
-	int numTrianglesInThisChunk;
-	int junk1;
-	int junk2;
-	int junk3;
-	triangle collision[12];
-
-	int triangleIndices[MAX_TRIANGLES_PER_CHUNK];
-};
-
-struct Mesh
+#include "Scene.h"
+#include "Bvh.h"
+#include "CpuTracer.h"
+#include "MeshCache.h"
+#include "Quantize.h"
+#include "TextureCache.h"
+#include "StartupProfile.h"
+
+// Every mesh, once. A mesh only says where its triangles and nodes
+// are in the pools, it is put into the world by instances
+std::vector<Mesh> meshes;
+
+// Every copy of a mesh in the world, with its texture and ray tracing
+// properties. initScene fills everything but the matrices. The GPU
+// gets a copy of this in instanceBuffer, and Compute.glsl writes the
+// matrices there. The CPU tracer gets its matrices in here
+std::vector<instance> sceneInstances;
+
+// The model matrix of every instance, and every light, at the
+// time that is being drawn. animateScene fills these every frame
+std::vector<glm::mat4x4> sceneMatrices;
+std::vector<light> sceneLights;
+
+// Most instances move every frame, but some never do (the floor), or
+// only when the camera moves (the sky). findDirtyInstances compares the
+// new matrices with the matrices that the instances already have, and
+// only the instances that changed are transformed again, and get a new
+// box in the world. The others keep what they have on the GPU
+std::vector<glm::mat4x4> instanceMatrices;	// the matrix each instance has now
+std::vector<int> dirtyInstances;			// the instances that moved this frame
+std::vector<glm::mat4x4> dirtyMatrices;		// their new matrices, in the same order
+
+// The box around each instance in the world, for the top level BVH
+std::vector<glm::vec3> instanceMins;
+std::vector<glm::vec3> instanceMaxs;
+
+// Every triangle of every mesh, packed one mesh after another.
+// Each Mesh has the offset of its first triangle in here
+std::vector<triangle> trianglePool;
+
+// The color of every triangle in trianglePool, at the same
+// index. Rays only read these for the triangle they hit
+std::vector<triangleAttributes> attributePool;
+
+// The positions of the points of every mesh, one mesh after
+// another. Each triangle has the indices of its three points
+std::vector<glm::vec4> vertexPool;
+
+// The UVs and normals of every point in vertexPool, at the same index
+std::vector<vertexAttributes> vertexAttributePool;
+
+// With --quantize, the compact form of vertexAttributePool, and every
+// color of attributePool once, see Quantize.h. The buffers get these
+// instead of the full size pools
+std::vector<packedVertexAttributes> packedVertexAttributePool;
+std::vector<glm::vec4> colorPalette;
+
+// The BVH nodes of every mesh, one mesh after another.
+// Each Mesh has the offset of its root node in here
+std::vector<bvhNode> nodePool;
+
+// The top level BVH, over the instances in the world. It is
+// built again every frame, after the instances move
+std::vector<bvhNode> tlasNodePool;
+
+// The leaves of the top level BVH have a range of this
+// list, which has the index of the instance for each item
+std::vector<int> tlasInstancePool;
+
+// The buffers are sized when the scene is built, to fit
+// exactly the triangles and nodes that we have. They stay
+// in object space, so they are only written once
+GLuint triangleBuffer;
+int trianglePoolSize = 0;
+
+GLuint attributeBuffer;
+int attributePoolSize = 0;
+
+GLuint nodeBuffer;
+int nodePoolSize = 0;
+
+GLuint vertexBuffer;
+int vertexPoolSize = 0;
+
+GLuint vertexAttributeBuffer;
+int vertexAttributePoolSize = 0;
+
+// The meshes never change, so the compute
+// shader and fragment shader share one buffer
+GLuint meshBuffer;
+int meshesSize = 0;
+
+// The compute shader writes the matrices of every
+// instance in here, for the fragment shader
+GLuint instanceBuffer;
+int instancesSize = 0;
+
+// The data that changes every frame is written straight into buffers
+// that stay mapped for as long as the program runs, so there is no
+// glBufferData (which makes the driver find new memory) every frame.
+// The GPU can still be drawing the last frame while the CPU writes the
+// next one, so each buffer has a section for each of the last
+// FRAMES_IN_FLIGHT frames. A fence is put after the work of each frame,
+// and the CPU only waits when it comes back around to a section
+// that the GPU has not finished reading yet
+#define FRAMES_IN_FLIGHT 3
+
+struct RingBuffer
 {
-	glm::vec4 min;
-	glm::vec4 max;
-
-	int numTriangles;
-	int optimizationLevel; // 1 for single box, 2 for octants
-	int boolUseEffects;
-	int reflectionLevel;
-	triangle collision[12];
-	
-	chunk chunk[8];
-	triangle triangles[MAX_TRIANGLES_PER_MESH];
+	GLuint buffer = 0;
+	int sectionSize = 0;			// bytes for one frame, rounded up so every section can be bound
+	unsigned char* memory = nullptr;	// the whole buffer, mapped
 };
 
-Mesh* meshes;
-
-struct light {
-	glm::vec4 pos;
-	glm::vec4 color;
-	float radius;
-	float brightness;
-	float junk1;
-	float junk2;
-};
-
-GLuint trianglesCompToFrag;
-int trianglesCompToFragSize = sizeof(Mesh) * MAX_MESHES;
-
-GLuint triangleObjToComp;
-int triangleObjToCompSize = sizeof(Mesh) * MAX_MESHES;
-
-GLuint lightToFrag;
-int lightToFragSize = sizeof(light) * MAX_LIGHTS;
-
-GLuint matrixBuffer;
-int matrixBufferSize = sizeof(glm::mat4x4) * MAX_MESHES;
-
-// optimization
-int numMeshesLev1 = 0;
-int numMeshesLev2 = 0;
+// Which section is written this frame, and the fence of each section
+int ringFrame = 0;
+GLsync ringFences[FRAMES_IN_FLIGHT] = {};
+
+// The top level BVH, written every frame. The fragment shader is told
+// how many nodes there are, because the buffer is as big as the most
+// nodes that the instances can need
+RingBuffer tlasNodeRing;
+RingBuffer tlasInstanceRing;
+GLuint numTlasNodes_loc;
+
+// Like the pools, these are sized by initScene,
+// for the lights and instances that the scene has
+RingBuffer lightRing;
+int lightToFragSize = 0;
+
+// The new matrices and the indices of the instances that moved this
+// frame, for Compute.glsl. They are as big as every instance, but only
+// the start is filled, numDirty_loc tells the shader how many
+RingBuffer matrixRing;
+int matrixBufferSize = 0;
+RingBuffer dirtyRing;
+GLuint numDirty_loc;
 
 // This is your reference to your shader program.
 // This will be assigned with glCreateProgram().
@@ -113,6 +202,10 @@ int numMeshesLev2 = 0;
 GLuint draw_program;
 GLuint transform_program;
 
+// How many instances each work group of Compute.glsl
+// transforms, from its local_size_x
+GLint transformGroupSize = 1;
+
 // These are your references to your actual compiled shaders
 GLuint vertex_shader;
 GLuint fragment_shader;
@@ -126,16 +219,119 @@ GLuint ray01;
 GLuint ray10;
 GLuint ray11;
 
-// texture information
-GLuint tex_loc[MAX_MESHES];
-GLuint m_texture[MAX_TEXTURES];
+// Every texture of the scene is one layer of this texture array, so
+// the shader binds one sampler, no matter how many textures there are
+GLuint textureArray = 0;
+GLuint textures_loc;
 GLuint sampler = 0;
 
+// The size of every layer, see createTextureArray
+int textureArrayWidth = 0;
+int textureArrayHeight = 0;
+int textureArrayLevels = 0;
+
+// How much of its layer one copy of each texture covers,
+// initScene copies it into the instances that use the texture
+std::vector<glm::vec2> textureScales;
+
+// The smallest power of two that is at least size
+int nextPowerOfTwo(int size)
+{
+	int p = 1;
+
+	while (p < size)
+		p *= 2;
+
+	return p;
+}
+
+// When this is true (--cpu), main() renders every frame with
+// the CPU tracer in CpuTracer.cpp, and never creates an OpenGL context
+bool useCpuBackend = false;
+
+// When this is true (--quantize), the UVs, normals, and colors are
+// packed into fewer bytes, and the tracers unpack them when they are read
+bool quantizeAttributes = false;
+
+// Decoded textures, for the CPU tracer
+std::vector<CpuTexture> cpuTextures;
+
+// Statistics of the CPU tracer
+CpuStats cpuStats;
+unsigned long long totalCpuRays = 0;
+unsigned long long totalCpuTriangleTests = 0;
+
 // A variable used to describe the position of the camera.
 glm::vec3 cameraPos;
 
+#ifdef HEADLESS_RENDER
+// There is no window, so the EGL display and context
+// take its place, and we render into our own framebuffer
+EGLDisplay eglDisplay = EGL_NO_DISPLAY;
+EGLContext eglContext = EGL_NO_CONTEXT;
+#else
 // A reference to our window.
 GLFWwindow* window;
+#endif
+
+// Our own framebuffer, used when there is no window, and
+// by the benchmark, which renders at sizes that no window has
+GLuint frameBuffer = 0;
+GLuint colorBuffer = 0;
+
+// Benchmark mode (--benchmark) renders the same moments of the animation,
+// at the same resolutions, every time it runs. Every frame is timed one
+// stage at a time, and the results are written to benchmark.json, so that
+// the speed of different builds (and machines) can be compared
+bool benchmarkMode = false;
+
+// The times in the animation, in seconds, that the benchmark renders
+float benchmarkTimes[] = { 0.0f, 2.5f, 5.0f, 7.5f, 10.0f, 12.5f };
+
+// The width and height of each resolution that the benchmark renders
+int benchmarkResolutions[][2] = { { 320, 180 }, { 640, 360 }, { 1280, 720 } };
+
+// How long each stage of the last frame took, in seconds of wall time.
+// The GPU runs on its own, so we only know how long a GPU stage took
+// if we wait for it to finish, which the benchmark does. Otherwise the
+// GPU stages only measure how long it took to give the GPU the work
+struct FrameTimes
+{
+	double transform;	// Compute.glsl (or cpuUpdateInstances) and the top level BVH
+	double trace;		// FragmentShader.glsl (or cpuRenderFrame)
+	double readback;	// glReadPixels, 0 for the CPU tracer
+	double encode;		// converting the pixels to a PNG, and writing it
+};
+
+FrameTimes frameTimes;
+
+// How long the GPU itself spent on each pass. A GL_TIMESTAMP query is
+// put before and after glDispatchCompute and glDrawArrays, and the GPU
+// writes the time when it gets to each one. (GL_TIME_ELAPSED does the
+// same with one query, but Mesa loses the start of the first compute
+// pass with it.) The result of a query is only ready once the GPU has
+// done the pass, and asking for it sooner makes the CPU wait, like
+// glFinish. So each ring section has its own queries, and they are read
+// by waitForRingFrame, when it comes back around to that section and its
+// fence has passed, a few frames later
+GLuint transformQueries[FRAMES_IN_FLIGHT][2];	// start and end
+GLuint traceQueries[FRAMES_IN_FLIGHT][2];
+bool transformQueryUsed[FRAMES_IN_FLIGHT] = {};	// false when nothing moved, and there was no dispatch
+bool traceQueryUsed[FRAMES_IN_FLIGHT] = {};
+
+// The GPU time of each pass, in seconds, for every frame that has been read
+std::vector<double> gpuTransformTimes;
+std::vector<double> gpuTraceTimes;
+
+// The fastest, average, and 99th percentile (only 1 in 100 frames
+// is slower) time of a pass, over many frames
+struct PassStats
+{
+	int frames;
+	double min;
+	double avg;
+	double p99;
+};
 
 // Variables you will need to calculate FPS.
 int tempFrame = 0;
@@ -156,9 +352,9 @@ int maxFrames = videoFPS * videoSeconds;
 // It also takes vec3 center, the position the camera's view is centered on.
 // Then it will takes a vec3 up which is a vector that defines the upward direction. (So if you point it down, the camera view will be upside down.)
 // Then it takes a float defining the verticle field of view angle. It also takes a float defining the ratio of the screen (in this case, 800/600 pixels).
-// The last four parameters are actually just variables for this function to output data into. They should be pointers to pre-defined vec4 variables.
+// The last parameter is an array of four vec3 for this function to output the rays into (r00, r01, r10, r11).
 // For a visual reference, see this image: https://camo.githubusercontent.com/21a84a8b21d6a4bc98b9992e8eaeb7d7acb1185d/687474703a2f2f63646e2e6c776a676c2e6f72672f7475746f7269616c732f3134313230385f676c736c5f636f6d707574652f726179696e746572706f6c6174696f6e2e706e67
-void calcCameraRays(glm::vec3 eye, glm::vec3 center, glm::vec3 up, float fov, float ratio)
+void calcCameraRays(glm::vec3 eye, glm::vec3 center, glm::vec3 up, float fov, float ratio, glm::vec3* rays)
 {
 	// Grab a ray from the camera position toward where the camera is to be centered on.
 	glm::vec3 centerRay = center - eye;
@@ -187,19 +383,27 @@ void calcCameraRays(glm::vec3 eye, glm::vec3 center, glm::vec3 up, float fov, fl
 	glm::vec4 r10 = glm::vec4(centerRay, 1.0f) * glm::rotate(glm::mat4(1), glm::radians(fov * ratio / 2.0f), v) * glm::rotate(glm::mat4(1), glm::radians(fov / 2.0f), glm::vec3(uRotateRight));
 	glm::vec4 r11 = glm::vec4(centerRay, 1.0f) * glm::rotate(glm::mat4(1), glm::radians(fov * ratio / 2.0f), v) * glm::rotate(glm::mat4(1), glm::radians(-fov / 2.0f), glm::vec3(uRotateRight));
 
-	// Now set the uniform variables in the shader to match our camera variables (cameraPos = eye, then four corner rays)
-	glUniform3f(eye_loc, eye.x, eye.y, eye.z);
-	glUniform3f(ray00, r00.x, r00.y, r00.z);
-	glUniform3f(ray01, r01.x, r01.y, r01.z);
-	glUniform3f(ray10, r10.x, r10.y, r10.z);
-	glUniform3f(ray11, r11.x, r11.y, r11.z);
+	// Output the four corner rays
+	rays[0] = glm::vec3(r00);
+	rays[1] = glm::vec3(r01);
+	rays[2] = glm::vec3(r10);
+	rays[3] = glm::vec3(r11);
+}
+
+// Seconds since the program started, this replaces
+// glfwGetTime, because the headless build has no GLFW.
+// It is the same clock as the startup profile
+double getTime()
+{
+	return ProfileTime();
 }
 
-// This function runs every frame
-void renderScene()
+// Used for FPS, this runs at the start of every frame, with any backend.
+// It returns the time that the animations should show in this frame
+float beginFrame()
 {
 	// Used for FPS
-	dtime = glfwGetTime();
+	dtime = getTime();
 	totalTime = dtime;
 
 	// Every second, basically.
@@ -215,16 +419,15 @@ void renderScene()
 			" Frame: " + std::to_string(totalFrame) + 
 			" / " + std::to_string(maxFrames);
 
-		glfwSetWindowTitle(window, s.c_str());
+#ifndef HEADLESS_RENDER
+		if (!useCpuBackend)
+			glfwSetWindowTitle(window, s.c_str());
+		else
+#endif
+			// no window title, so print it to the console instead
+			printf("%s\n", s.c_str());
 	}
 
-	// set camera position
-	cameraPos = glm::vec3(
-		0.0f,
-		6.0f,
-		10.0f
-	);
-
 	// There are two different ways of animating. We can 
 	// animate with respect to the time elapsed in the program, or we can
 	// animate with respect to the time elapsed in the video. 
@@ -248,13 +451,20 @@ void renderScene()
 	// choose which one you want here
 	float time = totalTimeElapsedInVideo;
 
-	//=================================================================
+	return time;
+}
 
-	// start using transform program
-	glUseProgram(transform_program);
+// Everything that moves in the scene, at a given time: the camera,
+// the model matrix of every instance (test), and every light
+void animateScene(float time, glm::mat4x4* test, light* lights)
+{
+	// set camera position
+	cameraPos = glm::vec3(
+		0.0f,
+		6.0f,
+		10.0f
+	);
 
-	glm::mat4x4 test[MAX_MESHES];
-	
 	// scale the floor
 	test[0] = glm::mat4(1);
 	test[0] = glm::translate(test[0],glm::vec3(0, -0.5, 0));
@@ -319,22 +529,6 @@ void renderScene()
 	test[9] = glm::translate(test[9], cameraPos - glm::vec3(0, 10, 0));
 	test[9] = glm::scale(test[9], glm::vec3(100));
 
-	glBindBuffer(GL_UNIFORM_BUFFER, matrixBuffer);
-	glBufferData(GL_UNIFORM_BUFFER, matrixBufferSize, test, GL_DYNAMIC_DRAW); // static because CPU won't touch it
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
-
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, trianglesCompToFrag);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, triangleObjToComp);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, matrixBuffer);
-	glDispatchCompute(NUM_TRIANGLES_IN_SCENE + numMeshesLev1*12 + (numMeshesLev2+1)*8*12, 1, 1);
-
-	//=================================================================
-
-	// start using draw program
-	glUseProgram(draw_program);
-
-	light lights[MAX_LIGHTS];
-
 	// white light
 	lights[0].color = glm::vec4(1.0, 1.0, 1.0, 0.0);
 	lights[0].radius = 7;
@@ -394,21 +588,412 @@ void renderScene()
 		-4 * cos(time),
 		0
 	);
+}
 
-	glBindBuffer(GL_UNIFORM_BUFFER, lightToFrag); // 'lights' is a pointer
-	glBufferData(GL_UNIFORM_BUFFER, lightToFragSize, lights, GL_DYNAMIC_DRAW); // static because CPU won't touch it
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+// Finds the instances whose matrix in matrices is not the matrix that
+// they have now, and puts them in dirtyInstances and dirtyMatrices.
+// The first time, every instance is dirty
+void findDirtyInstances(const glm::mat4x4* matrices)
+{
+	int numInstances = (int)sceneInstances.size();
+	bool first = instanceMatrices.size() != (size_t)numInstances;
+
+	if (first)
+		instanceMatrices.resize(numInstances);
+
+	dirtyInstances.clear();
+	dirtyMatrices.clear();
+
+	for (int i = 0; i < numInstances; i++)
+	{
+		// every number has to be exactly the same
+		if (!first && memcmp(&instanceMatrices[i], &matrices[i], sizeof(glm::mat4x4)) == 0)
+			continue;
+
+		instanceMatrices[i] = matrices[i];
+		dirtyInstances.push_back(i);
+		dirtyMatrices.push_back(matrices[i]);
+	}
+}
+
+// Builds the top level BVH for this frame. Each instance's box in the world
+// is the box around the top few levels of its mesh's BVH, moved by its model
+// matrix (see TransformBVHBounds). Only the instances that moved get a new
+// box, and the BVH over the boxes is the only part of the scene that is
+// rebuilt every frame. It only has one item per instance, no matter how
+// many triangles it has
+void BuildSceneTLAS()
+{
+	int numInstances = (int)sceneInstances.size();
+
+	instanceMins.resize(numInstances);
+	instanceMaxs.resize(numInstances);
+
+	for (size_t d = 0; d < dirtyInstances.size(); d++)
+	{
+		int i = dirtyInstances[d];
+		const Mesh& mesh = meshes[sceneInstances[i].mesh];
+
+		// This mesh has no triangles
+		if (mesh.numNodes == 0)
+			continue;
+
+		TransformBVHBounds(&nodePool[mesh.firstNode], instanceMatrices[i], instanceMins[i], instanceMaxs[i]);
+	}
+
+	std::vector<glm::vec3> mins(numInstances);
+	std::vector<glm::vec3> maxs(numInstances);
+	std::vector<int> ids(numInstances);
+	int count = 0;
+
+	for (int i = 0; i < numInstances; i++)
+	{
+		if (meshes[sceneInstances[i].mesh].numNodes == 0)
+			continue;
+
+		mins[count] = instanceMins[i];
+		maxs[count] = instanceMaxs[i];
+		ids[count] = i;
+		count++;
+	}
+
+	BuildTLAS(mins.data(), maxs.data(), ids.data(), count, tlasNodePool, tlasInstancePool);
+}
+
+// Makes ring with a section of size bytes for each frame in flight. Its
+// memory is mapped once, and is never unmapped, the GPU reads it while the
+// CPU still has it. It is coherent, so what the CPU writes is seen by any
+// draw or dispatch that is started after it, with no flush.
+// Returns false if the buffer can't be mapped
+bool createRingBuffer(RingBuffer& ring, int size)
+{
+	// glBindBufferRange can only start a storage buffer at a
+	// multiple of this, so every section starts at one
+	GLint alignment = 1;
+	glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+
+	ring.sectionSize = (size + alignment - 1) / alignment * alignment;
+
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	GLsizeiptr bytes = (GLsizeiptr)ring.sectionSize * FRAMES_IN_FLIGHT;
+
+	glGenBuffers(1, &ring.buffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, ring.buffer);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, bytes, nullptr, flags);
+	ring.memory = (unsigned char*)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, bytes, flags);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	if (ring.memory == nullptr)
+	{
+		printf("Error: can't map a buffer of %d bytes, error 0x%x\n", (int)bytes, glGetError());
+		return false;
+	}
+
+	return true;
+}
+
+// Unmaps ring, and frees its buffer
+void deleteRingBuffer(RingBuffer& ring)
+{
+	if (ring.memory != nullptr)
+	{
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, ring.buffer);
+		glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	glDeleteBuffers(1, &ring.buffer);
+	ring = RingBuffer();
+}
+
+// Copies size bytes of data into the section of ring for this frame
+void writeRingBuffer(const RingBuffer& ring, const void* data, int size)
+{
+	memcpy(ring.memory + ringFrame * ring.sectionSize, data, size);
+}
+
+// Binds the first size bytes of the section of ring for this frame,
+// so the shader's array is as long as what was written
+void bindRingBuffer(const RingBuffer& ring, int binding, int size)
+{
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, ring.buffer, (GLintptr)ringFrame * ring.sectionSize, size);
+}
+
+// The time in seconds between the two timestamps of queries
+double readTimestamps(const GLuint queries[2])
+{
+	GLuint64 start = 0;
+	GLuint64 end = 0;
+	glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &start);
+	glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &end);
+
+	// the timestamps are in nanoseconds
+	return (end - start) / 1000000000.0;
+}
+
+// Reads the GPU times of the frame that used ring section, which the GPU
+// has to be done with, and adds them to gpuTransformTimes and gpuTraceTimes
+void readPassTimers(int section)
+{
+	if (transformQueryUsed[section])
+	{
+		gpuTransformTimes.push_back(readTimestamps(transformQueries[section]));
+		transformQueryUsed[section] = false;
+	}
+
+	if (traceQueryUsed[section])
+	{
+		gpuTraceTimes.push_back(readTimestamps(traceQueries[section]));
+		traceQueryUsed[section] = false;
+	}
+}
+
+// Reads the GPU times of the frames that are still in flight, oldest
+// first. Only call this after glFinish, or it waits for the GPU
+void finishPassTimers()
+{
+	for (int i = 0; i < FRAMES_IN_FLIGHT; i++)
+		readPassTimers((ringFrame + i) % FRAMES_IN_FLIGHT);
+}
+
+PassStats getPassStats(std::vector<double> times)
+{
+	PassStats stats = {};
+	stats.frames = (int)times.size();
+
+	if (times.empty())
+		return stats;
+
+	std::sort(times.begin(), times.end());
+
+	double sum = 0;
+
+	for (double t : times)
+		sum += t;
+
+	// the time that 99% of the frames are at or under
+	size_t p99 = (size_t)ceil(0.99 * times.size()) - 1;
+
+	stats.min = times.front();
+	stats.avg = sum / times.size();
+	stats.p99 = times[p99];
+
+	return stats;
+}
+
+// Prints the GPU time of each pass, in milliseconds
+void printPassTimers()
+{
+	PassStats transform = getPassStats(gpuTransformTimes);
+	PassStats trace = getPassStats(gpuTraceTimes);
+
+	printf("%10s %8s %12s %12s %12s\n", "GPU pass", "frames", "min ms", "avg ms", "p99 ms");
+	printf("%10s %8d %12.4f %12.4f %12.4f\n", "transform", transform.frames, transform.min * 1000, transform.avg * 1000, transform.p99 * 1000);
+	printf("%10s %8d %12.4f %12.4f %12.4f\n", "trace", trace.frames, trace.min * 1000, trace.avg * 1000, trace.p99 * 1000);
+}
+
+// Waits until the GPU is done with the frame that last used this frame's
+// section. With FRAMES_IN_FLIGHT sections, that frame was drawn
+// FRAMES_IN_FLIGHT - 1 frames ago, so this almost never waits
+void waitForRingFrame()
+{
+	GLsync fence = ringFences[ringFrame];
+
+	if (fence == nullptr)
+		return;
+
+	// Only the first wait needs to flush, so that
+	// the fence is sure to reach the GPU
+	GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+
+	while (glClientWaitSync(fence, flags, 1000000000) == GL_TIMEOUT_EXPIRED)
+		flags = 0;
+
+	glDeleteSync(fence);
+	ringFences[ringFrame] = nullptr;
+
+	// that frame's queries are done too, so this does not wait
+	readPassTimers(ringFrame);
+}
+
+// This function runs every frame, and draws the scene at this time in the animation
+void renderScene(float time)
+{
+	double stageStart = getTime();
+
+	// the GPU has to be done with the section that we write this frame
+	waitForRingFrame();
+
+	// move everything to where it is at this time
+	animateScene(time, sceneMatrices.data(), sceneLights.data());
+
+	//=================================================================
+
+	findDirtyInstances(sceneMatrices.data());
+
+	int numDirty = (int)dirtyInstances.size();
+
+	// When nothing moved, the instances on the GPU are already right
+	if (numDirty > 0)
+	{
+		// start using transform program
+		glUseProgram(transform_program);
+
+		// only the matrices that changed are sent
+		writeRingBuffer(matrixRing, dirtyMatrices.data(), sizeof(glm::mat4x4) * numDirty);
+		writeRingBuffer(dirtyRing, dirtyInstances.data(), sizeof(int) * numDirty);
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instanceBuffer);
+		bindRingBuffer(dirtyRing, 1, sizeof(int) * numDirty);
+		bindRingBuffer(matrixRing, 2, sizeof(glm::mat4x4) * numDirty);
+
+		glUniform1ui(numDirty_loc, (GLuint)numDirty);
+
+		// one invocation for every instance that moved, the triangles are
+		// not touched. Round up, so the last group gets the instances that are left
+		GLuint numGroups = ((GLuint)numDirty + transformGroupSize - 1) / transformGroupSize;
+		glQueryCounter(transformQueries[ringFrame][0], GL_TIMESTAMP);
+		glDispatchCompute(numGroups, 1, 1);
+		glQueryCounter(transformQueries[ringFrame][1], GL_TIMESTAMP);
+		transformQueryUsed[ringFrame] = true;
+
+		// the fragment shader reads what the compute shader wrote
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+
+	// the top level BVH is small, so the CPU builds it while the GPU works
+	BuildSceneTLAS();
+
+	int tlasNodesSize = sizeof(bvhNode) * (int)tlasNodePool.size();
+	int tlasInstancesSize = sizeof(int) * (int)tlasInstancePool.size();
+
+	writeRingBuffer(tlasNodeRing, tlasNodePool.data(), tlasNodesSize);
+	writeRingBuffer(tlasInstanceRing, tlasInstancePool.data(), tlasInstancesSize);
+
+	if (benchmarkMode)
+		glFinish();
+
+	frameTimes.transform = getTime() - stageStart;
+	stageStart = getTime();
+
+	//=================================================================
+
+	// start using draw program
+	glUseProgram(draw_program);
+
+	writeRingBuffer(lightRing, sceneLights.data(), lightToFragSize);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, meshBuffer);
+	bindRingBuffer(lightRing, 1, lightToFragSize);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, triangleBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, nodeBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, attributeBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, instanceBuffer);
+
+	// A range can't be empty, the shader does not read
+	// these when there are no nodes in the top level BVH
+	if (tlasNodesSize > 0)
+	{
+		bindRingBuffer(tlasNodeRing, 6, tlasNodesSize);
+		bindRingBuffer(tlasInstanceRing, 7, tlasInstancesSize);
+	}
 
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, trianglesCompToFrag);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, lightToFrag);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, vertexBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, vertexAttributeBuffer);
 
 	// Call the function we created to calculate the corner rays.
 	// We use the camera position, the focus position, and the up direction (just like glm::lookAt)
 	// We use Field of View, and aspect ratio (just like glm::perspective)
-	calcCameraRays(cameraPos, glm::vec3(0.0f, 0.5f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), 45.0f, (float)width / height);
+	glm::vec3 rays[4];
+	calcCameraRays(cameraPos, glm::vec3(0.0f, 0.5f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), 45.0f, (float)width / height, rays);
+
+	// Now set the uniform variables in the shader to match our camera variables (cameraPos = eye, then four corner rays)
+	glUniform3f(eye_loc, cameraPos.x, cameraPos.y, cameraPos.z);
+	glUniform3f(ray00, rays[0].x, rays[0].y, rays[0].z);
+	glUniform3f(ray01, rays[1].x, rays[1].y, rays[1].z);
+	glUniform3f(ray10, rays[2].x, rays[2].y, rays[2].z);
+	glUniform3f(ray11, rays[3].x, rays[3].y, rays[3].z);
+	glUniform1i(numTlasNodes_loc, (int)tlasNodePool.size());
 
 	// Draw an image on the screen
+	glQueryCounter(traceQueries[ringFrame][0], GL_TIMESTAMP);
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	glQueryCounter(traceQueries[ringFrame][1], GL_TIMESTAMP);
+	traceQueryUsed[ringFrame] = true;
+
+	if (benchmarkMode)
+		glFinish();
+
+	frameTimes.trace = getTime() - stageStart;
+
+	// This frame's sections can be written again once
+	// the GPU gets past this, FRAMES_IN_FLIGHT frames from now
+	ringFences[ringFrame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	ringFrame = (ringFrame + 1) % FRAMES_IN_FLIGHT;
+
+	// help us keep track of FPS
+	tempFrame++;
+	totalFrame++;
+}
+
+// This function runs every frame instead of renderScene, when we use
+// the CPU backend. It does the same work as the two shader programs,
+// and writes the image straight into pixels
+void renderSceneCPU(float time, unsigned char* pixels)
+{
+	double stageStart = getTime();
+
+	// move everything to where it is at this time
+	animateScene(time, sceneMatrices.data(), sceneLights.data());
+
+	// the work of Compute.glsl, only for the instances that moved
+	findDirtyInstances(sceneMatrices.data());
+	cpuUpdateInstances(dirtyMatrices.data(), dirtyInstances.data(), (int)dirtyInstances.size(), sceneInstances.data());
+
+	BuildSceneTLAS();
+
+	frameTimes.transform = getTime() - stageStart;
+
+	// the work of FragmentShader.glsl
+	CpuFrame frame;
+	frame.meshes = meshes.data();
+	frame.triangles = trianglePool.data();
+	frame.attributes = attributePool.data();
+	frame.vertices = vertexPool.data();
+	frame.vertexAttribs = vertexAttributePool.data();
+	frame.packedVertexAttribs = quantizeAttributes ? packedVertexAttributePool.data() : nullptr;
+	frame.palette = quantizeAttributes ? colorPalette.data() : nullptr;
+	frame.nodes = nodePool.data();
+	frame.instances = sceneInstances.data();
+	frame.tlasNodes = tlasNodePool.data();
+	frame.tlasInstances = tlasInstancePool.data();
+	frame.numTlasNodes = (int)tlasNodePool.size();
+	frame.lights = sceneLights.data();
+	frame.numLights = (int)sceneLights.size();
+	frame.width = width;
+	frame.height = height;
+	frame.textures = cpuTextures.data();
+
+	glm::vec3 rays[4];
+	calcCameraRays(cameraPos, glm::vec3(0.0f, 0.5f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), 45.0f, (float)width / height, rays);
+
+	frame.eye = cameraPos;
+	frame.ray00 = rays[0];
+	frame.ray01 = rays[1];
+	frame.ray10 = rays[2];
+	frame.ray11 = rays[3];
+
+	cpuRenderFrame(frame, pixels, cpuStats);
+	frameTimes.trace = cpuStats.seconds;
+	totalCpuRays += cpuStats.rays;
+	totalCpuTriangleTests += cpuStats.triangleTests;
+
+	// the benchmark prints its own table
+	if (!benchmarkMode)
+		printf("Frame %d: %f seconds, %f million rays per second, %f million triangle tests per second\n",
+			totalFrame, cpuStats.seconds,
+			cpuStats.rays / cpuStats.seconds / 1000000.0,
+			cpuStats.triangleTests / cpuStats.seconds / 1000000.0);
 
 	// help us keep track of FPS
 	tempFrame++;
@@ -449,6 +1034,34 @@ std::string readShader(std::string fileName)
 	return shaderCode;
 }
 
+// Puts defines (lines of #define) into the code of a shader, right after
+// the #version line, which has to be the first line of code. The #line
+// after them keeps the line numbers of compile errors the same as the file
+std::string addShaderDefines(std::string sourceCode, std::string defines)
+{
+	size_t version = sourceCode.find("#version");
+
+	if (version == std::string::npos)
+		return defines + sourceCode;
+
+	size_t endOfLine = sourceCode.find('\n', version);
+
+	if (endOfLine == std::string::npos)
+		return sourceCode + "\n" + defines;
+
+	// the #version line is line 1 plus the newlines before it
+	int nextLine = 2;
+
+	for (size_t i = 0; i < version; i++)
+	{
+		if (sourceCode[i] == '\n')
+			nextLine++;
+	}
+
+	return sourceCode.substr(0, endOfLine + 1) + defines +
+		"#line " + std::to_string(nextLine) + "\n" + sourceCode.substr(endOfLine + 1);
+}
+
 // This method will consolidate some of the shader code we've written to return a GLuint to the compiled shader.
 // It only requires the shader source code and the shader type.
 GLuint createShader(std::string sourceCode, GLenum shaderType)
@@ -497,375 +1110,728 @@ GLuint createShader(std::string sourceCode, GLenum shaderType)
 	return shader;
 }
 
-void loadOBJ(char* path, Mesh* m)
+// Adds a mesh that was made in its own pools (see MeshCache.h) to the
+// end of the pools of the scene, as mesh m. The triangles and BVH nodes
+// only have indices inside the mesh, so nothing changes but where the
+// mesh starts in each pool. For a mesh from a cache file, this is the
+// only copy, straight out of the mapping
+void addMesh(Mesh* m, const Mesh& built, const MeshData& data)
 {
-	// Part 1
-	// Initialize variables and pointers
-
-	FILE *f = fopen(path, "r");
-	//delete path;
-
-	float x[3];
-	unsigned short y[9];
+	*m = built;
+	m->firstTriangle = (int)trianglePool.size();
+	m->firstVertex = (int)vertexPool.size();
+	m->firstNode = (int)nodePool.size();
+
+	trianglePool.insert(trianglePool.end(), data.triangles, data.triangles + data.numTriangles);
+	attributePool.insert(attributePool.end(), data.attributes, data.attributes + data.numTriangles);
+	vertexPool.insert(vertexPool.end(), data.vertices, data.vertices + data.numVertices);
+	vertexAttributePool.insert(vertexAttributePool.end(), data.vertexAttribs, data.vertexAttribs + data.numVertices);
+	nodePool.insert(nodePool.end(), data.nodes, data.nodes + data.numNodes);
+}
 
-	std::vector<float>pos;
-	std::vector<float>uvs;
-	std::vector<float>norms;
-	std::vector<unsigned short>faces;
-	char line[100];
+// Asset loading =========================================================
+// Every texture and OBJ file is read on worker threads, each one into
+// its own memory, so a slow PNG decode does not hold up the others.
+// OpenGL can only be used on the thread that owns the context, so the
+// workers only decode the textures (or map their cache files, see
+// TextureCache.h), and the main thread gives them to OpenGL after
+// that. The meshes are added to the pools by the main thread too,
+// in the same order every time
 
+struct TextureAsset
+{
+	const char* file = nullptr;
+	bool loaded = false;
+	TextureData data;	// every mip level, see LoadTextureData
 
-	// Part 2
-	// Fill vectors for pos, uvs, norms, and faces
+	// so the list below only needs the file of each one
+	TextureAsset(const char* file) : file(file) {}
+};
 
-	while (fgets(line, sizeof(line), f))
-	{
-		if (sscanf(line, "v %f %f %f", &x[0], &x[1], &x[2]) == 3)
-			for (int i = 0; i < 3; i++)
-				pos.push_back(x[i]);
+// A mesh that is loaded into its own pools, see LoadMesh
+struct MeshAsset
+{
+	const char* file = nullptr;
+	bool loaded = false;
+	Mesh m = Mesh();
+	BvhStats stats = BvhStats();
+	MeshData data;
 
-		if (sscanf(line, "vt %f %f", &x[0], &x[1]) == 2)
-			for (int i = 0; i < 2; i++)
-				uvs.push_back(x[i]);
+	MeshAsset(const char* file) : file(file) {}
+};
 
-		if (sscanf(line, "vn %f %f %f", &x[0], &x[1], &x[2]) == 3)
-			for (int i = 0; i < 3; i++)
-				norms.push_back(x[i]);
+// The textures are the first jobs, because the big PNG
+// decodes take the longest, so the workers start on them first.
+// Add a file to one of these lists, and everything that holds
+// textures or meshes grows to fit it
+TextureAsset textureAssets[] = {
+	{ "../Assets/texture.jpg" },
+	{ "../Assets/CarColor.png" },
+	{ "../Assets/CatColor.png" },
+	{ "../Assets/DogColor.png" },
+	{ "../Assets/night1.png" },
+};
 
-		if (sscanf(line, "f %hu/%hu/%hu %hu/%hu/%hu %hu/%hu/%hu", &y[0], &y[1], &y[2], &y[3], &y[4], &y[5], &y[6], &y[7], &y[8]) == 9)
-			for (int i = 0; i < 9; i++)
-				faces.push_back(y[i] - 1);
-	}
+MeshAsset meshAssets[] = {
+	{ "../Assets/GreenCar14.3Dobj" },
+	{ "../Assets/wheel.3Dobj" },
+	{ "../Assets/cat.3Dobj" },
+	{ "../Assets/dog.3Dobj" },
+	{ "../Assets/Skybox.3Dobj" },
+};
 
+const int numTextureAssets = sizeof(textureAssets) / sizeof(TextureAsset);
+const int numMeshAssets = sizeof(meshAssets) / sizeof(MeshAsset);
 
-	// Part 3
-	// Initialize more variables and pointers
+// Each worker takes the next job that nobody has taken yet,
+// jobs 0 to numTextureAssets - 1 are textures, the rest are meshes
+std::atomic<int> nextAssetJob;
+std::vector<std::thread> assetThreads;
+double assetLoadStart = 0;
 
-	int numVerts = 3 * (int)faces.size() / 9;
+// Loads one texture or mesh, on any thread
+void loadAsset(int job)
+{
+	if (job < numTextureAssets)
+	{
+		TextureAsset& t = textureAssets[job];
+		t.loaded = LoadTextureData(t.file, t.data);
+		return;
+	}
 
-	m->numTriangles = numVerts / 3;
+	MeshAsset& a = meshAssets[job - numTextureAssets];
+	a.loaded = LoadMesh(a.file, &a.m, a.data, a.stats);
+}
 
-	// Part 4
-	// Build final Vertex Buffer
+// thread is 0 on the main thread, the workers start at 1
+void assetWorker(int thread)
+{
+	int job;
 
-	// for every triangle
-	for (int i = 0; i < (int)numVerts / 3; i++)
-	{
-		// for every point
-		for (int j = 0; j < 3; j++)
-		{
-			// X, Y, and Z
-			for (int k = 0; k < 3; k++)
-			{
-				int coordIndex = 3 * faces[9 * i + 3 * j + 0] + k;
-				m->triangles[i].pos[j][k] = pos[coordIndex];
-			}
-
-			for (int k = 0; k < 2; k++)
-			{
-				int uvIndex = 2 * faces[9 * i + 3 * j + 1] + k;
-				m->triangles[i].uv[j][k] = uvs[uvIndex];
-			}
-
-			for (int k = 0; k < 3; k++)
-			{
-				int normalIndex = 3 * faces[9 * i + 3 * j + 2] + k;
-				m->triangles[i].normal[j][k] = norms[normalIndex];
-			}
-
-			m->triangles[i].pos[j][3] = 1.0f;
-			m->triangles[i].normal[j][3] = 1.0f;
-		}
+	SetProfileThread(thread);
 
-		m->triangles[i].color = glm::vec4(1.0, 1.0, 1.0, 1.0);
-	}
+	while ((job = nextAssetJob++) < numTextureAssets + numMeshAssets)
+		loadAsset(job);
+}
 
-	fclose(f);
+// Starts reading every asset in the background, so the main
+// thread can do something else, like compile the shaders
+void startLoadingAssets()
+{
+	assetLoadStart = getTime();
+	nextAssetJob = 0;
 
+	for (int i = 0; i < cpuThreadCount(); i++)
+		assetThreads.push_back(std::thread(assetWorker, i + 1));
 }
 
-void GetTrianglesInChunk(Mesh* m, int chunkIndex)
+// Helps the workers with the jobs that are left, and waits for them
+void finishLoadingAssets()
 {
-	m->chunk[chunkIndex].numTrianglesInThisChunk = 0;
+	assetWorker(0);
 
-	// Check every triangle in mesh
-	for (int i = 0; i < m->numTriangles; i++)
-	{
-		// check every point in every triangle
-		for (int j = 0; j < 3; j++)
-		{
-			// If any point of the triangle is in this chunk
+	// how long the main thread waited, after it ran out of jobs
+	double waitStart = getTime();
 
-			if (
-				(m->triangles[i].pos[j].x <= m->chunk[chunkIndex].max.x) &&
-				(m->triangles[i].pos[j].x >= m->chunk[chunkIndex].min.x) &&
+	for (size_t i = 0; i < assetThreads.size(); i++)
+		assetThreads[i].join();
 
-				(m->triangles[i].pos[j].y <= m->chunk[chunkIndex].max.y) &&
-				(m->triangles[i].pos[j].y >= m->chunk[chunkIndex].min.y) &&
+	assetThreads.clear();
 
-				(m->triangles[i].pos[j].z <= m->chunk[chunkIndex].max.z) &&
-				(m->triangles[i].pos[j].z >= m->chunk[chunkIndex].min.z)
-			   )
-			{
-				m->chunk[chunkIndex].triangleIndices[m->chunk[chunkIndex].numTrianglesInThisChunk++] = i;
+	AddStartupPhase("wait for asset workers", waitStart, 0);
 
-				// skip to next triangle
-				j = 3;
-			}
-		}
-	}
+	printf("Loaded %d textures and %d meshes in %.1f ms on %d threads\n",
+		numTextureAssets, numMeshAssets, (getTime() - assetLoadStart) * 1000.0, cpuThreadCount());
 }
 
-void MakeBox(triangle* t, glm::vec4 min, glm::vec4 max)
+// Adds a mesh that a worker loaded to the end of the pools, as mesh m
+void addMeshAsset(const MeshAsset& a, Mesh* m, BvhStats& stats)
 {
-	// -x side part 1
-	t[0].pos[0] = glm::vec4(min.x, min.y, min.z, 1.0);
-	t[0].pos[1] = glm::vec4(min.x, min.y, max.z, 1.0);
-	t[0].pos[2] = glm::vec4(min.x, max.y, max.z, 1.0);
-
-	// -x side part 2
-	t[1].pos[0] = glm::vec4(min.x, min.y, min.z, 1.0);
-	t[1].pos[1] = glm::vec4(min.x, max.y, min.z, 1.0);
-	t[1].pos[2] = glm::vec4(min.x, max.y, max.z, 1.0);
-
-	// +x side part 1
-	t[2].pos[0] = glm::vec4(max.x, min.y, min.z, 1.0);
-	t[2].pos[1] = glm::vec4(max.x, min.y, max.z, 1.0);
-	t[2].pos[2] = glm::vec4(max.x, max.y, max.z, 1.0);
-
-	// +x side part 2
-	t[3].pos[0] = glm::vec4(max.x, min.y, min.z, 1.0);
-	t[3].pos[1] = glm::vec4(max.x, max.y, min.z, 1.0);
-	t[3].pos[2] = glm::vec4(max.x, max.y, max.z, 1.0);
-
-	// -y side part 1
-	t[4].pos[0] = glm::vec4(min.x, min.y, min.z, 1.0);
-	t[4].pos[1] = glm::vec4(min.x, min.y, max.z, 1.0);
-	t[4].pos[2] = glm::vec4(max.x, min.y, max.z, 1.0);
-
-	// -y side part 2
-	t[5].pos[0] = glm::vec4(min.x, min.y, min.z, 1.0);
-	t[5].pos[1] = glm::vec4(max.x, min.y, min.z, 1.0);
-	t[5].pos[2] = glm::vec4(max.x, min.y, max.z, 1.0);
-
-	// +y side part 1
-	t[6].pos[0] = glm::vec4(min.x, max.y, min.z, 1.0);
-	t[6].pos[1] = glm::vec4(min.x, max.y, max.z, 1.0);
-	t[6].pos[2] = glm::vec4(max.x, max.y, max.z, 1.0);
-
-	// +y side part 2
-	t[7].pos[0] = glm::vec4(min.x, max.y, min.z, 1.0);
-	t[7].pos[1] = glm::vec4(max.x, max.y, min.z, 1.0);
-	t[7].pos[2] = glm::vec4(max.x, max.y, max.z, 1.0);
-
-	// -z side part 1
-	t[8].pos[0] = glm::vec4(min.x, min.y, min.z, 1.0);
-	t[8].pos[1] = glm::vec4(min.x, max.y, min.z, 1.0);
-	t[8].pos[2] = glm::vec4(max.x, max.y, min.z, 1.0);
-
-	// -z side part 2
-	t[9].pos[0] = glm::vec4(min.x, min.y, min.z, 1.0);
-	t[9].pos[1] = glm::vec4(max.x, min.y, min.z, 1.0);
-	t[9].pos[2] = glm::vec4(max.x, max.y, min.z, 1.0);
-
-	// +z side part 1
-	t[10].pos[0] = glm::vec4(min.x, min.y, max.z, 1.0);
-	t[10].pos[1] = glm::vec4(min.x, max.y, max.z, 1.0);
-	t[10].pos[2] = glm::vec4(max.x, max.y, max.z, 1.0);
-
-	// +z side part 2
-	t[11].pos[0] = glm::vec4(min.x, min.y, max.z, 1.0);
-	t[11].pos[1] = glm::vec4(max.x, min.y, max.z, 1.0);
-	t[11].pos[2] = glm::vec4(max.x, max.y, max.z, 1.0);
+	if (!a.loaded)
+	{
+		printf("Can't read file: %s\n", a.file);
+		return;
+	}
+
+	addMesh(m, a.m, a.data);
+	stats = a.stats;
 }
 
-void OptimizeMesh(Mesh* m, int meshIndex)
-{
-	// add 1 level of optimization if we have 50+ triangles
-	m->optimizationLevel += m->numTriangles >= 50;
+// =======================================================================
 
-	// add 1 level of optimization if we have 350+ triangles
-	m->optimizationLevel += m->numTriangles >= 350;
+// Makes the texture array, with a layer for every texture asset, after
+// the workers have decoded them all, so that we know the biggest one.
+// Every layer is the size of the biggest texture, rounded up to a power of two
+void createTextureArray()
+{
+	textureArrayWidth = 1;
+	textureArrayHeight = 1;
 
-	// If this mesh is too small for optimization, quit the function
-	if (m->optimizationLevel == 0)
+	for (int i = 0; i < numTextureAssets; i++)
 	{
-		printf("Mesh %d, optimization level %d, triangles %d\n",
-			meshIndex, 0, m->numTriangles);
+		if (!textureAssets[i].loaded)
+			continue;
 
-		return;
+		textureArrayWidth = std::max(textureArrayWidth, nextPowerOfTwo(textureAssets[i].data.width));
+		textureArrayHeight = std::max(textureArrayHeight, nextPowerOfTwo(textureAssets[i].data.height));
 	}
 
-	// count how many meshes use lev1 optimization
-	numMeshesLev1++;
+	textureArrayLevels = 1;
 
-	// Set min and max positions to the first point, to give
-	// us something to start with
-	m->min = m->triangles->pos[0];
-	m->max = m->triangles->pos[0];
+	while (TextureLevelWidth(textureArrayWidth, textureArrayLevels - 1) > 1 ||
+		TextureLevelWidth(textureArrayHeight, textureArrayLevels - 1) > 1)
+		textureArrayLevels++;
 
-	// loop through all triangles, find min and max
-	// position of the entire mesh, for meshBox
-	for (int i = 0; i < m->numTriangles; i++)
-	{
-		for (int j = 0; j < 3; j++)
-		{
-			if (m->triangles[i].pos[j].x < m->min.x) m->min.x = m->triangles[i].pos[j].x;
-			if (m->triangles[i].pos[j].x > m->max.x) m->max.x = m->triangles[i].pos[j].x;
+	// Create an OpenGL texture. It only ever uses texture unit 0
+	glGenTextures(1, &textureArray);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, textureArray);
 
-			if (m->triangles[i].pos[j].y < m->min.y) m->min.y = m->triangles[i].pos[j].y;
-			if (m->triangles[i].pos[j].y > m->max.y) m->max.y = m->triangles[i].pos[j].y;
+	// common parameters for all textures
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
 
-			if (m->triangles[i].pos[j].z < m->min.z) m->min.z = m->triangles[i].pos[j].z;
-			if (m->triangles[i].pos[j].z > m->max.z) m->max.z = m->triangles[i].pos[j].z;
-		}
+	// Make room for every layer, one mipmap level at a time,
+	// LoadTexture fills them in
+	for (int level = 0; level < textureArrayLevels; level++)
+	{
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8,
+			TextureLevelWidth(textureArrayWidth, level), TextureLevelWidth(textureArrayHeight, level),
+			numTextureAssets, 0, GL_BGRA, GL_UNSIGNED_BYTE, nullptr);
 	}
 
-	// make box based on min and max
-	MakeBox(&m->collision[0], m->min, m->max);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, textureArrayLevels - 1);
 
-	// If you dont need the mesh chopped into 4 chunks, quit now
-	if (m->optimizationLevel == 1)
-	{
-		printf("Mesh %d, optimization level %d, triangles %d\n",
-			meshIndex, 1, m->numTriangles);
+	// make the sampler, and bind it to the same texture unit
+	glGenSamplers(1, &sampler);
+	glBindSampler(0, sampler);
 
+	// GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT = 34047
+	// GL_TEXTURE_MAX_ANISOTROPY_EXT = 34046
+
+	GLfloat maxAnisotropy = 0.0f;
+	glGetFloatv(34047, &maxAnisotropy);
+
+	// Trilinear Mipmapping
+	glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glSamplerParameteri(sampler, 34046, (GLint)maxAnisotropy);
+
+	textureScales.assign(numTextureAssets, glm::vec2(1, 1));
+}
+
+// The size that a texture is stretched to along one side, so that it fits
+// in its layer a whole number of times. A 256 texture in a 1024 layer is
+// not stretched, a 234 texture is stretched to 256. Each mipmap level of
+// the layer holds the same number of copies as level 0 only until a side
+// of the texture is down to 1 pixel. A side can't get any smaller, so
+// after that the copies along it halve at each level, and uvScale does
+// not count them anymore. That happens at the last few levels of a
+// texture with the same shape as the layer, and sooner along the short
+// side of a wider (or taller) texture. The 1 pixel is the average of the
+// whole texture along that side, so every copy looks the same there, and
+// those levels still blur to the right color
+int textureTileSize(int size, int layerSize)
+{
+	int tile = layerSize;
+
+	while (tile / 2 >= size)
+		tile /= 2;
+
+	return tile;
+}
+
+// Gives a texture that a worker decoded to the tracer, on the main thread
+void LoadTexture(TextureAsset& asset, int index)
+{
+	TextureData& data = asset.data;
+
+	if (!asset.loaded)
+	{
+		printf("Can't read file: %s\n", asset.file);
 		return;
 	}
 
-	// count how many meshes use lev2 optimization
-	numMeshesLev2++;
+	double start = getTime();
 
-	// calculate chunk min and max
+	// The CPU tracer keeps the pixels in memory, instead of an OpenGL
+	// texture. It has no mipmaps, so it only keeps level 0
+	if (useCpuBackend)
+	{
+		CpuTexture& t = cpuTextures[index];
+		t.width = data.width;
+		t.height = data.height;
+		t.bits.assign(data.pixels, data.pixels + 4 * (size_t)t.width * t.height);
 
-	// get the midpoint of the box
-	glm::vec4 midpoint = glm::vec4(
-		m->max.x - ((m->max.x - m->min.x) / 2.0f),
-		m->max.y - ((m->max.y - m->min.y) / 2.0f),
-		m->max.z - ((m->max.z - m->min.z) / 2.0f),
-		1.0f
-	);
+		FreeTextureData(data);
 
-	int id = 0;
+		AddStartupPhase(std::string("copy texture ") + asset.file, start, (long long)t.bits.size());
+		return;
+	}
 
-	// 0: -x, -y, -z
-	m->chunk[id].min = glm::vec4(m->min.x, m->min.y, m->min.z, 1.0f);
-	m->chunk[id].max = glm::vec4(midpoint.x, midpoint.y, midpoint.z, 1.0f);
+	// A texture that is smaller than its layer is copied over the whole
+	// layer, like tiles. The layer repeats (GL_REPEAT) exactly where each
+	// copy of the texture would repeat, so the shader only scales the UV
+	// down to one copy, and the bilinear and mipmap filters at the edges
+	// read the next copy, the same as a texture of its own would
+	ResizeTextureData(data, textureTileSize(data.width, textureArrayWidth), textureTileSize(data.height, textureArrayHeight));
 
-	id++;
+	textureScales[index] = glm::vec2((float)data.width / textureArrayWidth, (float)data.height / textureArrayHeight);
 
-	// 1: -x, +y, -z
-	m->chunk[id].min = glm::vec4(m->min.x, midpoint.y, m->min.z, 1.0f);
-	m->chunk[id].max = glm::vec4(midpoint.x, m->max.y, midpoint.z, 1.0f);
+	// Fill layer index of the texture array, one mipmap level at a time.
+	// The levels were made ahead of time, so there is no glGenerateMipmap,
+	// and when they come from a cache file (and are not stretched), OpenGL
+	// reads them straight out of the mapped file. Each row is 4 bytes per
+	// pixel, so rows of the small levels are not padded
+	glBindTexture(GL_TEXTURE_2D_ARRAY, textureArray);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 
-	id++;
+	for (int level = 0; level < textureArrayLevels; level++)
+	{
+		// a small texture runs out of levels first, then its 1x1 level fills the layer
+		int textureLevel = std::min(level, data.numLevels - 1);
+		int width = TextureLevelWidth(data.width, textureLevel);
+		int height = TextureLevelWidth(data.height, textureLevel);
+		const unsigned char* pixels = data.pixels + TextureLevelOffset(data.width, data.height, textureLevel);
 
-	// 2: +x, -y, -z
-	m->chunk[id].min = glm::vec4(midpoint.x, m->min.y, m->min.z, 1.0f);
-	m->chunk[id].max = glm::vec4(m->max.x, midpoint.y, midpoint.z, 1.0f);
+		for (int y = 0; y < TextureLevelWidth(textureArrayHeight, level); y += height)
+		{
+			for (int x = 0; x < TextureLevelWidth(textureArrayWidth, level); x += width)
+				glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, x, y, index, width, height, 1, GL_BGRA, GL_UNSIGNED_BYTE, pixels);
+		}
+	}
 
-	id++;
+	// We can unload the image now that the texture data has been buffered with opengl
+	FreeTextureData(data);
 
-	// 3: +x, +y, -z
-	m->chunk[id].min = glm::vec4(midpoint.x, midpoint.y, m->min.z, 1.0f);
-	m->chunk[id].max = glm::vec4(m->max.x, m->max.y, midpoint.z, 1.0f);
+	// every level of the layer is filled
+	AddStartupPhase(std::string("upload texture ") + asset.file, start,
+		(long long)TextureLevelOffset(textureArrayWidth, textureArrayHeight, textureArrayLevels));
+}
 
-	id++;
+// Adds a copy of mesh to the world, with a texture, and
+// the default ray tracing properties
+void addInstance(int mesh, int texture)
+{
+	instance in = {};
+	in.mesh = mesh;
+	in.texture = texture;
+	in.boolUseEffects = 1;
+	in.reflectionLevel = 2;
 
-	// 4: -x, -y, +z
-	m->chunk[id].min = glm::vec4(m->min.x, m->min.y, midpoint.z, 1.0f);
-	m->chunk[id].max = glm::vec4(midpoint.x, midpoint.y, m->max.z, 1.0f);
+	// The CPU tracer has no texture array, so its textures are not scaled
+	in.uvScale = textureScales.empty() ? glm::vec2(1, 1) : textureScales[texture];
 
-	id++;
+	sceneInstances.push_back(in);
+}
 
-	// 5: -x, +y, +z
-	m->chunk[id].min = glm::vec4(m->min.x, midpoint.y, midpoint.z, 1.0f);
-	m->chunk[id].max = glm::vec4(midpoint.x, m->max.y, m->max.z, 1.0f);
+// How many bytes the pools, meshes, and instances take, after initScene
+long long sceneBytes()
+{
+	return (long long)trianglePoolSize + attributePoolSize + nodePoolSize +
+		vertexPoolSize + vertexAttributePoolSize + meshesSize + instancesSize;
+}
 
-	id++;
+// Initialization code
+// Builds every mesh in the scene, puts instances of them in the world, and
+// sets the ray tracing properties of each instance. This is all done on
+// the CPU, so both backends use it
+void initScene()
+{
+	double start = getTime();
+
+	// The quad and the cube are made here, the rest of the meshes
+	// are loaded. Every mesh starts with zeros, so a mesh that
+	// is never loaded has no triangles
+	meshes.assign(2 + numMeshAssets, Mesh());
+
+	// what the BVH of each mesh looks like
+	std::vector<BvhStats> stats(meshes.size(), BvhStats());
+
+	// The quad and cube are written with their own copy of every
+	// point, BuildMesh merges the points that are the same
+	expandedTriangle quad[2];
+	quad[0].pos[0] = glm::vec4(-5.0, 0.0, 5.0, 1.0); 
+	quad[0].pos[1] = glm::vec4(-5.0, 0.0, -5.0, 1.0);
+	quad[0].pos[2] = glm::vec4(5.0, 0.0, -5.0, 1.0);
+	quad[0].uv[0] = glm::vec4(0, 1, 1, 1);
+	quad[0].uv[1] = glm::vec4(0, 0, 1, 1);
+	quad[0].uv[2] = glm::vec4(1, 0, 1, 1);
+	quad[0].normal[0] = glm::vec4(0.0, 1.0, 0.0, 1.0); 
+	quad[0].color = glm::vec4(1.0, 1.0, 1.0, 1.0);
+
+	quad[1].pos[0] = glm::vec4(-5.0, 0.0, 5.0, 1.0);
+	quad[1].pos[1] = glm::vec4(5.0, 0.0, -5.0, 1.0);
+	quad[1].pos[2] = glm::vec4(5.0, 0.0, 5.0, 1.0);
+	quad[1].uv[0] = glm::vec4(0, 1, 1, 1);
+	quad[1].uv[1] = glm::vec4(1, 0, 1, 1);
+	quad[1].uv[2] = glm::vec4(1, 1, 1, 1);
+	quad[1].normal[0] = glm::vec4(0.0, 1.0, 0.0, 1.0);
+	quad[1].color = glm::vec4(1.0, 1.0, 1.0, 1.0);
 
-	// 6: +x, -y, +z
-	m->chunk[id].min = glm::vec4(midpoint.x, m->min.y, midpoint.z, 1.0f);
-	m->chunk[id].max = glm::vec4(m->max.x, midpoint.y, m->max.z, 1.0f);
+	// Mesh 0 is a plane
+	// It should have one normal per triangle
+	// dulicate the first normal we give it
+	for (int i = 0; i < 2; i++)
+	{
+		quad[i].normal[1] = quad[i].normal[0];
+		quad[i].normal[2] = quad[i].normal[0];
+	}
 
-	id++;
+	expandedTriangle cube[12];
+	cube[0].pos[0] = glm::vec4(-0.5, -0.5, -0.5, 1.0);
+	cube[0].pos[1] = glm::vec4(0.5, -0.5, -0.5, 1.0);
+	cube[0].pos[2] = glm::vec4(-0.5, 0.5, -0.5, 1.0);
+	cube[0].uv[0] = glm::vec4(0, 0, 1, 1);
+	cube[0].uv[1] = glm::vec4(1, 0, 1, 1);
+	cube[0].uv[2] = glm::vec4(0, 1, 1, 1);
+	cube[0].normal[0] = glm::vec4(0.0, 0.0, -1.0, 1.0);
+	cube[0].color = glm::vec4(1.0, 0.5, 0.2, 1.0);
+		   
+	cube[1].pos[0] = glm::vec4(0.5, -0.5, -0.5, 1.0);
+	cube[1].pos[1] = glm::vec4(0.5, 0.5, -0.5, 1.0);
+	cube[1].pos[2] = glm::vec4(-0.5, 0.5, -0.5, 1.0);
+	cube[1].uv[0] = glm::vec4(1, 0, 1, 1);
+	cube[1].uv[1] = glm::vec4(1, 1, 1, 1);
+	cube[1].uv[2] = glm::vec4(0, 1, 1, 1);
+	cube[1].normal[0] = glm::vec4(0.0, 0.0, -1.0, 1.0);
+	cube[1].color = glm::vec4(1.0, 0.5, 0.2, 1.0);
+		   
+	cube[2].pos[0] = glm::vec4(-0.5, -0.5, 0.5, 1.0);
+	cube[2].pos[1] = glm::vec4(-0.5, 0.5, 0.5, 1.0);
+	cube[2].pos[2] = glm::vec4(0.5, 0.5, 0.5, 1.0);
+	cube[2].uv[0] = glm::vec4(0, 0, 1, 1);
+	cube[2].uv[1] = glm::vec4(0, 1, 1, 1);
+	cube[2].uv[2] = glm::vec4(1, 1, 1, 1);
+	cube[2].normal[0] = glm::vec4(0.0, 0.0, 1.0, 1.0);
+	cube[2].color = glm::vec4(1.0, 0.5, 0.2, 1.0);
+		   
+	cube[3].pos[0] = glm::vec4(-0.5, -0.5, 0.5, 1.0);
+	cube[3].pos[1] = glm::vec4(0.5, 0.5, 0.5, 1.0);
+	cube[3].pos[2] = glm::vec4(0.5, -0.5, 0.5, 1.0);
+	cube[3].uv[0] = glm::vec4(0, 0, 1, 1);
+	cube[3].uv[1] = glm::vec4(1, 1, 1, 1);
+	cube[3].uv[2] = glm::vec4(1, 0, 1, 1);
+	cube[3].normal[0] = glm::vec4(0.0, 0.0, 1.0, 1.0);
+	cube[3].color = glm::vec4(1.0, 0.5, 0.2, 1.0);
+		   
+	cube[4].pos[0] = glm::vec4(0.5, -0.5, 0.5, 1.0);
+	cube[4].pos[1] = glm::vec4(0.5, 0.5, 0.5, 1.0);
+	cube[4].pos[2] = glm::vec4(0.5, 0.5, -0.5, 1.0);
+	cube[4].uv[0] = glm::vec4(0, 1, 1, 1);
+	cube[4].uv[1] = glm::vec4(1, 1, 1, 1);
+	cube[4].uv[2] = glm::vec4(1, 0, 1, 1);
+	cube[4].normal[0] = glm::vec4(1.0, 0.0, 0.0, 1.0);
+	cube[4].color = glm::vec4(1.0, 0.5, 0.2, 1.0);
+		   
+	cube[5].pos[0] = glm::vec4(0.5, -0.5, 0.5, 1.0);
+	cube[5].pos[1] = glm::vec4(0.5, 0.5, -0.5, 1.0);
+	cube[5].pos[2] = glm::vec4(0.5, -0.5, -0.5, 1.0);
+	cube[5].uv[0] = glm::vec4(0, 1, 1, 1);
+	cube[5].uv[1] = glm::vec4(1, 0, 1, 1);
+	cube[5].uv[2] = glm::vec4(0, 0, 1, 1);
+	cube[5].normal[0] = glm::vec4(1.0, 0.0, 0.0, 1.0);
+	cube[5].color = glm::vec4(1.0, 0.5, 0.2, 1.0);
+
+	cube[6].pos[0] = glm::vec4(-0.5, -0.5, -0.5, 1.0);
+	cube[6].pos[1] = glm::vec4(-0.5, 0.5, -0.5, 1.0);
+	cube[6].pos[2] = glm::vec4(-0.5, 0.5, 0.5, 1.0);
+	cube[6].uv[0] = glm::vec4(0, 0, 1, 1);
+	cube[6].uv[1] = glm::vec4(1, 0, 1, 1);
+	cube[6].uv[2] = glm::vec4(1, 1, 1, 1);
+	cube[6].normal[0] = glm::vec4(-1.0, 0.0, 0.0, 1.0);
+	cube[6].color = glm::vec4(1.0, 0.5, 0.2, 1.0);
+
+	cube[7].pos[0] = glm::vec4(-0.5, -0.5, -0.5, 1.0);
+	cube[7].pos[1] = glm::vec4(-0.5, 0.5, 0.5, 1.0);
+	cube[7].pos[2] = glm::vec4(-0.5, -0.5, 0.5, 1.0);
+	cube[7].uv[0] = glm::vec4(0, 0, 1, 1);
+	cube[7].uv[1] = glm::vec4(1, 1, 1, 1);
+	cube[7].uv[2] = glm::vec4(0, 1, 1, 1);
+	cube[7].normal[0] = glm::vec4(-1.0, 0.0, 0.0, 1.0);
+	cube[7].color = glm::vec4(1.0, 0.5, 0.2, 1.0);
+
+	cube[8].pos[0] = glm::vec4(-0.5, 0.5, 0.5, 1.0);
+	cube[8].pos[1] = glm::vec4(-0.5, 0.5, -0.5, 1.0);
+	cube[8].pos[2] = glm::vec4(0.5, 0.5, -0.5, 1.0);
+	cube[8].uv[0] = glm::vec4(0, 1, 1, 1);
+	cube[8].uv[1] = glm::vec4(0, 0, 1, 1);
+	cube[8].uv[2] = glm::vec4(1, 0, 1, 1);
+	cube[8].normal[0] = glm::vec4(0.0, 1.0, 0.0, 1.0);
+	cube[8].color = glm::vec4(1.0, 0.5, 0.2, 1.0);
+
+	cube[9].pos[0] = glm::vec4(-0.5, 0.5, 0.5, 1.0);
+	cube[9].pos[1] = glm::vec4(0.5, 0.5, -0.5, 1.0);
+	cube[9].pos[2] = glm::vec4(0.5, 0.5, 0.5, 1.0);
+	cube[9].uv[0] = glm::vec4(0, 1, 1, 1);
+	cube[9].uv[1] = glm::vec4(1, 0, 1, 1);
+	cube[9].uv[2] = glm::vec4(1, 1, 1, 1);
+	cube[9].normal[0] = glm::vec4(0.0, 1.0, 0.0, 1.0);
+	cube[9].color = glm::vec4(1.0, 0.5, 0.2, 1.0);
+
+	cube[10].pos[0] = glm::vec4(-0.5, -0.5, 0.5, 1.0);
+	cube[10].pos[1] = glm::vec4(-0.5, -0.5, -0.5, 1.0);
+	cube[10].pos[2] = glm::vec4(0.5, -0.5, -0.5, 1.0);
+	cube[10].uv[0] = glm::vec4(0, 1, 1, 1);
+	cube[10].uv[1] = glm::vec4(0, 0, 1, 1);
+	cube[10].uv[2] = glm::vec4(1, 0, 1, 1);
+	cube[10].normal[0] = glm::vec4(0.0, -1.0, 0.0, 1.0);
+	cube[10].color = glm::vec4(1.0, 0.5, 0.2, 1.0);
+
+	cube[11].pos[0] = glm::vec4(-0.5, -0.5, 0.5, 1.0);
+	cube[11].pos[1] = glm::vec4(0.5, -0.5, -0.5, 1.0);
+	cube[11].pos[2] = glm::vec4(0.5, -0.5, 0.5, 1.0);
+	cube[11].uv[0] = glm::vec4(0, 1, 1, 1);
+	cube[11].uv[1] = glm::vec4(1, 0, 1, 1);
+	cube[11].uv[2] = glm::vec4(1, 1, 1, 1);
+	cube[11].normal[0] = glm::vec4(0.0, -1.0, 0.0, 1.0);
+	cube[11].color = glm::vec4(1.0, 0.5, 0.2, 1.0);
+
+	// Mesh 1 is a cube
+	// It should have one normal per triangle
+	// dulicate the first normal we give it
+	for (int i = 0; i < 12; i++)
+	{
+		cube[i].normal[1] = cube[i].normal[0];
+		cube[i].normal[2] = cube[i].normal[0];
+	}
+
+	// The quad and the cube are made here, not loaded, so they
+	// get their face normals (for skipping triangles that face
+	// away from rays) and their BVH here too
+	Mesh built;
+	MeshData quadData;
+	MeshData cubeData;
+
+	BuildMesh(&built, quad, 2, quadData, stats[0]);
+	addMesh(&meshes[0], built, quadData);
+
+	BuildMesh(&built, cube, 12, cubeData, stats[1]);
+	addMesh(&meshes[1], built, cubeData);
+
+	// Mesh 2 is a car
+	// It will have one normal per vertex
+	addMeshAsset(meshAssets[0], &meshes[2], stats[2]);
+
+	// Mesh 3 is a wheel. It is only in the pools once,
+	// the four wheels of the car are instances of it
+	addMeshAsset(meshAssets[1], &meshes[3], stats[3]);
+
+	// Meshes 4, 5, and 6 are the cat, the dog, and the sky
+	addMeshAsset(meshAssets[2], &meshes[4], stats[4]);
+	addMeshAsset(meshAssets[3], &meshes[5], stats[5]);
+	addMeshAsset(meshAssets[4], &meshes[6], stats[6]);
+
+	// the loaded meshes are in the pools now, so their
+	// cache files can be unmapped
+	for (int i = 0; i < numMeshAssets; i++)
+		FreeMeshData(meshAssets[i].data);
+
+	// Put the meshes into the world. The instances are in the
+	// same order as the matrices that animateScene makes
+
+	sceneInstances.clear();
+
+	// Give Template texture to quad (instance 0)
+	addInstance(0, 0);
+
+	// Give Template texture to cube (instance 1)
+	addInstance(1, 0);
+
+	// Give Car texture to car (instance 2)
+	addInstance(2, 1);
+
+	// Give Car texture to wheel, each wheel moves
+	// differently, but they share one mesh (instances 3 to 6)
+	for (int i = 0; i < 4; i++)
+		addInstance(3, 1);
+
+	// Give Cat texture to cat (instance 7)
+	addInstance(4, 2);
+
+	// Give Dog texture to dog (instance 8)
+	addInstance(5, 3);
+
+	// skybox texture (instance 9)
+	addInstance(6, 4);
+
+	// animateScene gives every instance a matrix, and moves
+	// the five lights (white, red, blue, yellow, and green)
+	sceneMatrices.assign(sceneInstances.size(), glm::mat4(1));
+	sceneLights.assign(5, light());
+
+	// Change properties based on individual instances
+
+	// sky
+	sceneInstances[9].boolUseEffects = 0;
+	sceneInstances[9].reflectionLevel = 0;
+
+	// animals
+	sceneInstances[7].reflectionLevel = 0; // cat
+	sceneInstances[8].reflectionLevel = 0; // dog
+
+	// car wheels will probably only reflect ground
+	for (int i = 3; i < 7; i++)
+		sceneInstances[i].reflectionLevel = 1;
 
-	// 7: +x, +y, +z
-	m->chunk[id].min = glm::vec4(midpoint.x, midpoint.y, midpoint.z, 1.0f);
-	m->chunk[id].max = glm::vec4(m->max.x, m->max.y, m->max.z, 1.0f);
+// By default, this should be 0. By setting it to 1, you disable
+// lighting and relfection, then it's easier to change the scene,
+// for adding objects, changing animaitons, etc
+#define DEBUG_RAYTRACE 0
 
-	for (int i = 0; i < 8; i++)
+#if DEBUG_RAYTRACE
+	
+	// Disable all lighting and reflection
+	for (size_t i = 0; i < sceneInstances.size(); i++)
 	{
-		GetTrianglesInChunk(m, i);
-		MakeBox(&m->chunk[i].collision[0], m->chunk[i].min, m->chunk[i].max);
-		printf("Chunk %d: %d\n", i, m->chunk[i].numTrianglesInThisChunk);
+		sceneInstances[i].boolUseEffects = 0;
+		sceneInstances[i].reflectionLevel = 0;
 	}
+#endif
 
-	printf("Mesh %d, optimization level %d, triangles %d\n",
-		meshIndex, 2, m->numTriangles);
-}
+	int numMeshes = (int)meshes.size();
+	int numInstances = (int)sceneInstances.size();
 
-void LoadTexture(char* file, int index)
-{
-	// Load the file.
-	FIBITMAP* bitmap = FreeImage_Load(FreeImage_GetFileType(file), file);
-	// Convert the file to 32 bits so we can use it.
-	FIBITMAP* bitmap32 = FreeImage_ConvertTo32Bits(bitmap);
+	for (int i = 0; i < numMeshes; i++)
+	{
+		printf("Mesh %d, triangles %d, vertices %d, BVH nodes %d, leaves %d, depth %d, most triangles in a leaf %d\n",
+			i, meshes[i].numTriangles, meshes[i].numVertices, stats[i].numNodes, stats[i].numLeaves, stats[i].maxDepth, stats[i].maxTrianglesPerLeaf);
 
-	// Create an OpenGL texture.
-	glGenTextures(1, &m_texture[index]);
-	glActiveTexture(GL_TEXTURE0 + m_texture[index]);
-	glBindTexture(GL_TEXTURE_2D, m_texture[index]);
+		// Every triangle should be in exactly one leaf, inside its box
+		if (stats[i].numLostTriangles != 0)
+			printf("Error: the BVH of mesh %d loses %d triangles\n", i, stats[i].numLostTriangles);
+	}
 
-	// common parameters for all textures
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	int totalTri = 0;
+	int biggestMesh = 0;
+	
+	for (int i = 0; i < numMeshes; i++)
+	{
+		int n = meshes[i].numTriangles;
 
-	// make the sampler if it does not exist
-	if (sampler == 0)
-		glGenSamplers(1, &sampler);
+		if (biggestMesh < n)
+			biggestMesh = n;
 
-	// bind the sampler to the texture
-	glBindSampler(m_texture[index], sampler);
+		totalTri += n;
+	}
 
-	// GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT = 34047
-	// GL_TEXTURE_MAX_ANISOTROPY_EXT = 34046
+	// The triangles that are in the world, counting
+	// every instance, even though they are stored once
+	int worldTri = 0;
 
-	GLfloat maxAnisotropy = 0.0f;
-	glGetFloatv(34047, &maxAnisotropy);
+	for (int i = 0; i < numInstances; i++)
+		worldTri += meshes[sceneInstances[i].mesh].numTriangles;
 
-	// Trilinear Mipmapping
-	glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glSamplerParameteri(sampler, 34046, (GLint)maxAnisotropy);
+	printf("\n");
+	printf("Num Meshes: %d\n", numMeshes);
+	printf("Num Instances: %d\n", numInstances);
+	printf("Num Lights: %d\n", (int)sceneLights.size());
+	printf("Max Triangles Per Mesh: %d\n", biggestMesh);
+	printf("Total triangles in scene: %d\n", totalTri);
+	printf("Total triangles in the world: %d\n", worldTri);
+	printf("Total vertices in scene: %d\n", (int)vertexPool.size());
+	printf("Total BVH nodes in scene: %d\n", (int)nodePool.size());
+
+	trianglePoolSize = sizeof(triangle) * (int)trianglePool.size();
+	attributePoolSize = sizeof(triangleAttributes) * (int)attributePool.size();
+	nodePoolSize = sizeof(bvhNode) * (int)nodePool.size();
+	vertexPoolSize = sizeof(glm::vec4) * (int)vertexPool.size();
+	vertexAttributePoolSize = sizeof(vertexAttributes) * (int)vertexAttributePool.size();
+	meshesSize = sizeof(Mesh) * numMeshes;
+	instancesSize = sizeof(instance) * numInstances;
+	matrixBufferSize = sizeof(glm::mat4x4) * numInstances;
+	lightToFragSize = sizeof(light) * (int)sceneLights.size();
+
+	printf("Triangle pool: %d KB\n", trianglePoolSize / 1024);
+	printf("Attribute pool: %d KB\n", attributePoolSize / 1024);
+	printf("Vertex pool: %d KB\n", vertexPoolSize / 1024);
+	printf("Vertex attribute pool: %d KB\n", vertexAttributePoolSize / 1024);
+	printf("Node pool: %d KB\n", nodePoolSize / 1024);
+	printf("Meshes: %d KB\n", meshesSize / 1024);
+
+	// The buffers get the packed attributes and the palette instead
+	if (quantizeAttributes)
+	{
+		QuantizeAttributes(vertexAttributePool, attributePool, trianglePool, packedVertexAttributePool, colorPalette);
+
+		attributePoolSize = sizeof(glm::vec4) * (int)colorPalette.size();
+		vertexAttributePoolSize = sizeof(packedVertexAttributes) * (int)packedVertexAttributePool.size();
 
-	// Fill our openGL side texture object.
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, FreeImage_GetWidth(bitmap32), FreeImage_GetHeight(bitmap32),
-		0, GL_BGRA, GL_UNSIGNED_BYTE, static_cast<void*>(FreeImage_GetBits(bitmap32)));
-	glGenerateMipmap(GL_TEXTURE_2D);
+		printf("Quantized: %d colors in the palette, vertex attribute pool: %d KB\n",
+			(int)colorPalette.size(), vertexAttributePoolSize / 1024);
+	}
 
-	// We can unload the images now that the texture data has been buffered with opengl
-	FreeImage_Unload(bitmap);
-	FreeImage_Unload(bitmap32);
+	AddStartupPhase("build scene", start, sceneBytes());
 }
 
-// Initialization code
-void init()
+// Initialization code. Returns false if
+// this GPU can't run the ray tracer
+bool init()
 {
+	double start = getTime();
+
 	glewExperimental = GL_TRUE;
 	// Initializes the glew library
 	glewInit();
 
+	AddStartupPhase("glewInit", start, 0);
+
+	// The buffers that change every frame stay mapped (see RingBuffer),
+	// which needs glBufferStorage, from OpenGL 4.4. Without it, GLEW has
+	// no glBufferStorage to call, so we can't go on
+	GLint major = 0;
+	GLint minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+
+	if (major * 10 + minor < 44)
+	{
+		printf("Error: mapped buffers need OpenGL 4.4, this GPU has %d.%d\n", major, minor);
+		return false;
+	}
+
+	// The fragment shader reads 10 storage buffers. OpenGL 4.3 only
+	// promises 8, but desktop drivers give at least 16
+	GLint maxBlocks = 0;
+	glGetIntegerv(GL_MAX_FRAGMENT_SHADER_STORAGE_BLOCKS, &maxBlocks);
+
+	if (maxBlocks < 10)
+	{
+		printf("Error: the fragment shader needs 10 storage buffers, this GPU has %d\n", maxBlocks);
+		return false;
+	}
+
+	// Read the textures and meshes on other threads, while
+	// this thread sets up OpenGL and compiles the shaders.
+	// This comes after the checks above, so there are no
+	// workers left running if we stop
+	startLoadingAssets();
+
+	start = getTime();
+
 	// Read in the shader code from a file.
 	std::string vertShader = readShader("../Assets/VertexShader.glsl");
 	std::string fragShader = readShader("../Assets/FragmentShader.glsl");
 	std::string compShader = readShader("../Assets/Compute.glsl");
 
+	// The options that change the shader code are #defines. Every array
+	// in the shaders is as long as its buffer, or is a layer of the texture
+	// array, so the shaders do not need to know the size of the scene
+	std::string fragDefines;
+
+	if (quantizeAttributes)
+		fragDefines += "#define QUANTIZED_ATTRIBUTES\n";
+
+	fragShader = addShaderDefines(fragShader, fragDefines);
+
 	// createShader consolidates all of the shader compilation code
 	vertex_shader = createShader(vertShader, GL_VERTEX_SHADER);
 	fragment_shader = createShader(fragShader, GL_FRAGMENT_SHADER);
 	compute_shader = createShader(compShader, GL_COMPUTE_SHADER);
 
+	AddStartupPhase("read and compile shaders", start, (long long)(vertShader.size() + fragShader.size() + compShader.size()));
+	start = getTime();
+
 	// A shader is a program that runs on your GPU instead of your CPU. In this sense, OpenGL refers to your groups of shaders as "programs".
 	// Using glCreateProgram creates a shader program and returns a GLuint reference to it.
 	draw_program = glCreateProgram();
@@ -874,6 +1840,8 @@ void init()
 	glLinkProgram(draw_program);					// Link the program
 	// End of shader and program creation
 
+	AddStartupPhase("link draw program", start, 0);
+
 	// Tell our code to use the program
 	glUseProgram(draw_program);
 
@@ -885,407 +1853,655 @@ void init()
 	ray01 = glGetUniformLocation(draw_program, "ray01");
 	ray10 = glGetUniformLocation(draw_program, "ray10");
 	ray11 = glGetUniformLocation(draw_program, "ray11");
+	numTlasNodes_loc = glGetUniformLocation(draw_program, "numTlasNodes");
 
-	char* word = (char*)malloc(100);
+	textures_loc = glGetUniformLocation(draw_program, "textures");
 
-	for (int i = 0; i < MAX_MESHES; i++)
-	{
-		sprintf(word, "textureTest[%d]", i);
-		tex_loc[i] = glGetUniformLocation(draw_program, word);
-	}
-
-	delete word;
+	// Load Texture ========================================
 
-	glEnable(GL_TEXTURE_2D);
+	// The workers decoded them while the shaders compiled
+	finishLoadingAssets();
 
-	// Load Texture ========================================
+	start = getTime();
+	createTextureArray();
+	AddStartupPhase("allocate texture array", start, 0);
 
-	LoadTexture((char*)"../Assets/texture.jpg", 0);
-	LoadTexture((char*)"../Assets/CarColor.png", 1);
-	LoadTexture((char*)"../Assets/CatColor.png", 2);
-	LoadTexture((char*)"../Assets/DogColor.png", 3);
-	LoadTexture((char*)"../Assets/night1.png", 4);
+	for (int i = 0; i < numTextureAssets; i++)
+		LoadTexture(textureAssets[i], i);
 
 	// =====================================================
 
+	start = getTime();
+
 	transform_program = glCreateProgram();
 	glAttachShader(transform_program, compute_shader);
 	glLinkProgram(transform_program);					// Link the program
 	// End of shader and program creation
 
-	glGenBuffers(1, &matrixBuffer);
-	glBindBuffer(GL_UNIFORM_BUFFER, matrixBuffer);
-	glBufferData(GL_UNIFORM_BUFFER, matrixBufferSize, nullptr, GL_DYNAMIC_DRAW); // static because CPU won't touch it
+	// x, y, and z of local_size, we only use x
+	GLint groupSize[3];
+	glGetProgramiv(transform_program, GL_COMPUTE_WORK_GROUP_SIZE, groupSize);
+	transformGroupSize = groupSize[0];
+
+	numDirty_loc = glGetUniformLocation(transform_program, "numDirty");
+
+	AddStartupPhase("link transform program", start, 0);
+
+	// Build the meshes
+	initScene();
+
+	start = getTime();
+
+	// These are as big as the number of instances and lights, which we know
+	// now. A top level BVH has at most 2 * n - 1 nodes for n instances
+	int numInstances = (int)sceneInstances.size();
+
+	bool mapped =
+		createRingBuffer(matrixRing, matrixBufferSize) &&
+		createRingBuffer(dirtyRing, sizeof(int) * numInstances) &&
+		createRingBuffer(lightRing, lightToFragSize) &&
+		createRingBuffer(tlasNodeRing, sizeof(bvhNode) * glm::max(2 * numInstances - 1, 1)) &&
+		createRingBuffer(tlasInstanceRing, sizeof(int) * glm::max(numInstances, 1));
+
+	if (!mapped)
+		return false;
+
+	// the GPU timers of each ring section
+	glGenQueries(2 * FRAMES_IN_FLIGHT, &transformQueries[0][0]);
+	glGenQueries(2 * FRAMES_IN_FLIGHT, &traceQueries[0][0]);
+
+	// The texture array is on texture unit 0, and every
+	// instance has the index of its texture's layer
+	glUniform1i(textures_loc, 0);
+
+	// This sends our OBJ data to the Fragment Shader. The triangles,
+	// points, UVs, normals, colors, and BVH nodes stay in object space,
+	// so this data will be constant, and it will never be modified
+	glGenBuffers(1, &triangleBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, triangleBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, trianglePoolSize, trianglePool.data(), GL_STATIC_DRAW); // static because CPU won't touch it
 	glBindBuffer(GL_UNIFORM_BUFFER, 0);
 
-	meshes = new Mesh[MAX_MESHES];
-
-	meshes[0].numTriangles = 2;
-	meshes[0].triangles[0].pos[0] = glm::vec4(-5.0, 0.0, 5.0, 1.0); 
-	meshes[0].triangles[0].pos[1] = glm::vec4(-5.0, 0.0, -5.0, 1.0);
-	meshes[0].triangles[0].pos[2] = glm::vec4(5.0, 0.0, -5.0, 1.0);
-	meshes[0].triangles[0].uv[0] = glm::vec4(0, 1, 1, 1);
-	meshes[0].triangles[0].uv[1] = glm::vec4(0, 0, 1, 1);
-	meshes[0].triangles[0].uv[2] = glm::vec4(1, 0, 1, 1);
-	meshes[0].triangles[0].normal[0] = glm::vec4(0.0, 1.0, 0.0, 1.0); 
-	meshes[0].triangles[0].color = glm::vec4(1.0, 1.0, 1.0, 1.0);
-
-	meshes[0].triangles[1].pos[0] = glm::vec4(-5.0, 0.0, 5.0, 1.0);
-	meshes[0].triangles[1].pos[1] = glm::vec4(5.0, 0.0, -5.0, 1.0);
-	meshes[0].triangles[1].pos[2] = glm::vec4(5.0, 0.0, 5.0, 1.0);
-	meshes[0].triangles[1].uv[0] = glm::vec4(0, 1, 1, 1);
-	meshes[0].triangles[1].uv[1] = glm::vec4(1, 0, 1, 1);
-	meshes[0].triangles[1].uv[2] = glm::vec4(1, 1, 1, 1);
-	meshes[0].triangles[1].normal[0] = glm::vec4(0.0, 1.0, 0.0, 1.0);
-	meshes[0].triangles[1].color = glm::vec4(1.0, 1.0, 1.0, 1.0);
+	glGenBuffers(1, &attributeBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, attributeBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, attributePoolSize, quantizeAttributes ? (void*)colorPalette.data() : (void*)attributePool.data(), GL_STATIC_DRAW); // static because CPU won't touch it
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
 
-	// Mesh 0 is a plane
-	// It should have one normal per triangle
-	// dulicate the first normal we give it
-	for (int i = 0; i < meshes[0].numTriangles; i++)
+	glGenBuffers(1, &nodeBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, nodeBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, nodePoolSize, nodePool.data(), GL_STATIC_DRAW); // static because CPU won't touch it
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	glGenBuffers(1, &vertexBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, vertexBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, vertexPoolSize, vertexPool.data(), GL_STATIC_DRAW); // static because CPU won't touch it
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	glGenBuffers(1, &vertexAttributeBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, vertexAttributeBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, vertexAttributePoolSize, quantizeAttributes ? (void*)packedVertexAttributePool.data() : (void*)vertexAttributePool.data(), GL_STATIC_DRAW); // static because CPU won't touch it
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	// where the triangles and nodes of each mesh are
+	glGenBuffers(1, &meshBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, meshBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, meshesSize, meshes.data(), GL_STATIC_DRAW); // static because CPU won't touch it
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	// The mesh, texture, and ray tracing properties of every instance
+	// are set once here, the compute shader fills in the matrices every frame
+	glGenBuffers(1, &instanceBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, instanceBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, instancesSize, sceneInstances.data(), GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	AddStartupPhase("upload scene buffers", start, sceneBytes());
+
+	return true;
+}
+
+// Initialization code for the CPU backend. There is no
+// OpenGL here at all, so it runs on machines with no GPU
+void initCPU()
+{
+	printf("CPU backend, %d threads\n\n", cpuThreadCount());
+
+	startLoadingAssets();
+
+	// Load Texture ========================================
+
+	finishLoadingAssets();
+
+	cpuTextures.resize(numTextureAssets);
+
+	for (int i = 0; i < numTextureAssets; i++)
+		LoadTexture(textureAssets[i], i);
+
+	// =====================================================
+
+	// Build the meshes. The CPU tracer reads the
+	// pools directly, they never change
+	initScene();
+}
+
+#ifdef HEADLESS_RENDER
+// Creates an OpenGL context without a window. We ask EGL for the
+// surfaceless platform first, which works on machines that have no
+// display server at all (including Mesa's software renderer), and
+// fall back to the default display if that platform is missing
+bool createHeadlessContext()
+{
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+
+	if (getPlatformDisplay)
+		eglDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+
+	if (eglDisplay == EGL_NO_DISPLAY)
+		eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+	if (eglDisplay == EGL_NO_DISPLAY || !eglInitialize(eglDisplay, nullptr, nullptr))
 	{
-		meshes[0].triangles[i].normal[1] = meshes[0].triangles[i].normal[0];
-		meshes[0].triangles[i].normal[2] = meshes[0].triangles[i].normal[0];
+		printf("Could not initialize EGL, error 0x%x\n", eglGetError());
+		return false;
 	}
 
-	meshes[1].numTriangles = 12;
-	meshes[1].triangles[0].pos[0] = glm::vec4(-0.5, -0.5, -0.5, 1.0);
-	meshes[1].triangles[0].pos[1] = glm::vec4(0.5, -0.5, -0.5, 1.0);
-	meshes[1].triangles[0].pos[2] = glm::vec4(-0.5, 0.5, -0.5, 1.0);
-	meshes[1].triangles[0].uv[0] = glm::vec4(0, 0, 1, 1);
-	meshes[1].triangles[0].uv[1] = glm::vec4(1, 0, 1, 1);
-	meshes[1].triangles[0].uv[2] = glm::vec4(0, 1, 1, 1);
-	meshes[1].triangles[0].normal[0] = glm::vec4(0.0, 0.0, -1.0, 1.0);
-	meshes[1].triangles[0].color = glm::vec4(1.0, 0.5, 0.2, 1.0);
-		   
-	meshes[1].triangles[1].pos[0] = glm::vec4(0.5, -0.5, -0.5, 1.0);
-	meshes[1].triangles[1].pos[1] = glm::vec4(0.5, 0.5, -0.5, 1.0);
-	meshes[1].triangles[1].pos[2] = glm::vec4(-0.5, 0.5, -0.5, 1.0);
-	meshes[1].triangles[1].uv[0] = glm::vec4(1, 0, 1, 1);
-	meshes[1].triangles[1].uv[1] = glm::vec4(1, 1, 1, 1);
-	meshes[1].triangles[1].uv[2] = glm::vec4(0, 1, 1, 1);
-	meshes[1].triangles[1].normal[0] = glm::vec4(0.0, 0.0, -1.0, 1.0);
-	meshes[1].triangles[1].color = glm::vec4(1.0, 0.5, 0.2, 1.0);
-		   
-	meshes[1].triangles[2].pos[0] = glm::vec4(-0.5, -0.5, 0.5, 1.0);
-	meshes[1].triangles[2].pos[1] = glm::vec4(-0.5, 0.5, 0.5, 1.0);
-	meshes[1].triangles[2].pos[2] = glm::vec4(0.5, 0.5, 0.5, 1.0);
-	meshes[1].triangles[2].uv[0] = glm::vec4(0, 0, 1, 1);
-	meshes[1].triangles[2].uv[1] = glm::vec4(0, 1, 1, 1);
-	meshes[1].triangles[2].uv[2] = glm::vec4(1, 1, 1, 1);
-	meshes[1].triangles[2].normal[0] = glm::vec4(0.0, 0.0, 1.0, 1.0);
-	meshes[1].triangles[2].color = glm::vec4(1.0, 0.5, 0.2, 1.0);
-		   
-	meshes[1].triangles[3].pos[0] = glm::vec4(-0.5, -0.5, 0.5, 1.0);
-	meshes[1].triangles[3].pos[1] = glm::vec4(0.5, 0.5, 0.5, 1.0);
-	meshes[1].triangles[3].pos[2] = glm::vec4(0.5, -0.5, 0.5, 1.0);
-	meshes[1].triangles[3].uv[0] = glm::vec4(0, 0, 1, 1);
-	meshes[1].triangles[3].uv[1] = glm::vec4(1, 1, 1, 1);
-	meshes[1].triangles[3].uv[2] = glm::vec4(1, 0, 1, 1);
-	meshes[1].triangles[3].normal[0] = glm::vec4(0.0, 0.0, 1.0, 1.0);
-	meshes[1].triangles[3].color = glm::vec4(1.0, 0.5, 0.2, 1.0);
-		   
-	meshes[1].triangles[4].pos[0] = glm::vec4(0.5, -0.5, 0.5, 1.0);
-	meshes[1].triangles[4].pos[1] = glm::vec4(0.5, 0.5, 0.5, 1.0);
-	meshes[1].triangles[4].pos[2] = glm::vec4(0.5, 0.5, -0.5, 1.0);
-	meshes[1].triangles[4].uv[0] = glm::vec4(0, 1, 1, 1);
-	meshes[1].triangles[4].uv[1] = glm::vec4(1, 1, 1, 1);
-	meshes[1].triangles[4].uv[2] = glm::vec4(1, 0, 1, 1);
-	meshes[1].triangles[4].normal[0] = glm::vec4(1.0, 0.0, 0.0, 1.0);
-	meshes[1].triangles[4].color = glm::vec4(1.0, 0.5, 0.2, 1.0);
-		   
-	meshes[1].triangles[5].pos[0] = glm::vec4(0.5, -0.5, 0.5, 1.0);
-	meshes[1].triangles[5].pos[1] = glm::vec4(0.5, 0.5, -0.5, 1.0);
-	meshes[1].triangles[5].pos[2] = glm::vec4(0.5, -0.5, -0.5, 1.0);
-	meshes[1].triangles[5].uv[0] = glm::vec4(0, 1, 1, 1);
-	meshes[1].triangles[5].uv[1] = glm::vec4(1, 0, 1, 1);
-	meshes[1].triangles[5].uv[2] = glm::vec4(0, 0, 1, 1);
-	meshes[1].triangles[5].normal[0] = glm::vec4(1.0, 0.0, 0.0, 1.0);
-	meshes[1].triangles[5].color = glm::vec4(1.0, 0.5, 0.2, 1.0);
-
-	meshes[1].triangles[6].pos[0] = glm::vec4(-0.5, -0.5, -0.5, 1.0);
-	meshes[1].triangles[6].pos[1] = glm::vec4(-0.5, 0.5, -0.5, 1.0);
-	meshes[1].triangles[6].pos[2] = glm::vec4(-0.5, 0.5, 0.5, 1.0);
-	meshes[1].triangles[6].uv[0] = glm::vec4(0, 0, 1, 1);
-	meshes[1].triangles[6].uv[1] = glm::vec4(1, 0, 1, 1);
-	meshes[1].triangles[6].uv[2] = glm::vec4(1, 1, 1, 1);
-	meshes[1].triangles[6].normal[0] = glm::vec4(-1.0, 0.0, 0.0, 1.0);
-	meshes[1].triangles[6].color = glm::vec4(1.0, 0.5, 0.2, 1.0);
-
-	meshes[1].triangles[7].pos[0] = glm::vec4(-0.5, -0.5, -0.5, 1.0);
-	meshes[1].triangles[7].pos[1] = glm::vec4(-0.5, 0.5, 0.5, 1.0);
-	meshes[1].triangles[7].pos[2] = glm::vec4(-0.5, -0.5, 0.5, 1.0);
-	meshes[1].triangles[7].uv[0] = glm::vec4(0, 0, 1, 1);
-	meshes[1].triangles[7].uv[1] = glm::vec4(1, 1, 1, 1);
-	meshes[1].triangles[7].uv[2] = glm::vec4(0, 1, 1, 1);
-	meshes[1].triangles[7].normal[0] = glm::vec4(-1.0, 0.0, 0.0, 1.0);
-	meshes[1].triangles[7].color = glm::vec4(1.0, 0.5, 0.2, 1.0);
-
-	meshes[1].triangles[8].pos[0] = glm::vec4(-0.5, 0.5, 0.5, 1.0);
-	meshes[1].triangles[8].pos[1] = glm::vec4(-0.5, 0.5, -0.5, 1.0);
-	meshes[1].triangles[8].pos[2] = glm::vec4(0.5, 0.5, -0.5, 1.0);
-	meshes[1].triangles[8].uv[0] = glm::vec4(0, 1, 1, 1);
-	meshes[1].triangles[8].uv[1] = glm::vec4(0, 0, 1, 1);
-	meshes[1].triangles[8].uv[2] = glm::vec4(1, 0, 1, 1);
-	meshes[1].triangles[8].normal[0] = glm::vec4(0.0, 1.0, 0.0, 1.0);
-	meshes[1].triangles[8].color = glm::vec4(1.0, 0.5, 0.2, 1.0);
-
-	meshes[1].triangles[9].pos[0] = glm::vec4(-0.5, 0.5, 0.5, 1.0);
-	meshes[1].triangles[9].pos[1] = glm::vec4(0.5, 0.5, -0.5, 1.0);
-	meshes[1].triangles[9].pos[2] = glm::vec4(0.5, 0.5, 0.5, 1.0);
-	meshes[1].triangles[9].uv[0] = glm::vec4(0, 1, 1, 1);
-	meshes[1].triangles[9].uv[1] = glm::vec4(1, 0, 1, 1);
-	meshes[1].triangles[9].uv[2] = glm::vec4(1, 1, 1, 1);
-	meshes[1].triangles[9].normal[0] = glm::vec4(0.0, 1.0, 0.0, 1.0);
-	meshes[1].triangles[9].color = glm::vec4(1.0, 0.5, 0.2, 1.0);
-
-	meshes[1].triangles[10].pos[0] = glm::vec4(-0.5, -0.5, 0.5, 1.0);
-	meshes[1].triangles[10].pos[1] = glm::vec4(-0.5, -0.5, -0.5, 1.0);
-	meshes[1].triangles[10].pos[2] = glm::vec4(0.5, -0.5, -0.5, 1.0);
-	meshes[1].triangles[10].uv[0] = glm::vec4(0, 1, 1, 1);
-	meshes[1].triangles[10].uv[1] = glm::vec4(0, 0, 1, 1);
-	meshes[1].triangles[10].uv[2] = glm::vec4(1, 0, 1, 1);
-	meshes[1].triangles[10].normal[0] = glm::vec4(0.0, -1.0, 0.0, 1.0);
-	meshes[1].triangles[10].color = glm::vec4(1.0, 0.5, 0.2, 1.0);
-
-	meshes[1].triangles[11].pos[0] = glm::vec4(-0.5, -0.5, 0.5, 1.0);
-	meshes[1].triangles[11].pos[1] = glm::vec4(0.5, -0.5, -0.5, 1.0);
-	meshes[1].triangles[11].pos[2] = glm::vec4(0.5, -0.5, 0.5, 1.0);
-	meshes[1].triangles[11].uv[0] = glm::vec4(0, 1, 1, 1);
-	meshes[1].triangles[11].uv[1] = glm::vec4(1, 0, 1, 1);
-	meshes[1].triangles[11].uv[2] = glm::vec4(1, 1, 1, 1);
-	meshes[1].triangles[11].normal[0] = glm::vec4(0.0, -1.0, 0.0, 1.0);
-	meshes[1].triangles[11].color = glm::vec4(1.0, 0.5, 0.2, 1.0);
-
-	// Mesh 1 is a cube
-	// It should have one normal per triangle
-	// dulicate the first normal we give it
-	for (int i = 0; i < meshes[1].numTriangles; i++)
+	// We never draw to an EGL surface, the config is only
+	// used to create the context. If the display has no
+	// configs, we create the context without one
+	EGLint configAttribs[] = {
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE
+	};
+
+	EGLConfig config = nullptr;
+	EGLint numConfigs = 0;
+	eglChooseConfig(eglDisplay, configAttribs, &config, 1, &numConfigs);
+
+	if (numConfigs == 0)
+		config = EGL_NO_CONFIG_KHR;
+
+	// Desktop OpenGL 4.4 for compute shaders and mapped buffers. We
+	// want the compatibility profile, just like the GLFW window,
+	// because we draw the full-screen quad without a VAO
+	EGLint contextAttribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 4,
+		EGL_CONTEXT_MINOR_VERSION, 4,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT,
+		EGL_NONE
+	};
+
+	eglBindAPI(EGL_OPENGL_API);
+	eglContext = eglCreateContext(eglDisplay, config, EGL_NO_CONTEXT, contextAttribs);
+
+	// No surfaces, we draw into a framebuffer object instead
+	if (eglContext == EGL_NO_CONTEXT || !eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, eglContext))
 	{
-		meshes[1].triangles[i].normal[1] = meshes[1].triangles[i].normal[0];
-		meshes[1].triangles[i].normal[2] = meshes[1].triangles[i].normal[0];
+		printf("Could not create an OpenGL 4.4 context, error 0x%x\n", eglGetError());
+		return false;
 	}
 
-	// Mesh 2 is a car
-	// It will have one normal per vertex
-	loadOBJ((char*)"../Assets/GreenCar14.3Dobj", &meshes[2]);
-	loadOBJ((char*)"../Assets/wheel.3Dobj", &meshes[3]);
-	
-	// copy one wheel to make 4 wheels
-	for (int i = 0; i < 3; i++)
-		memcpy(&meshes[4+i], &meshes[3], sizeof(Mesh));
+	return true;
+}
+#else
+void window_size_callback(GLFWwindow* window, int w, int h)
+{
+	width = w;
+	height = h;
+	glViewport(0, 0, width, height);
+}
+#endif
 
-	loadOBJ((char*)"../Assets/cat.3Dobj", &meshes[7]);
-	loadOBJ((char*)"../Assets/dog.3Dobj", &meshes[8]);
-	loadOBJ((char*)"../Assets/Skybox.3Dobj", &meshes[9]);
+// Without a window there is no back buffer, so we make our own
+// framebuffer with one color attachment, and leave it bound.
+// Every glDrawArrays and glReadPixels will use it from now on
+void createFrameBuffer()
+{
+	glGenRenderbuffers(1, &colorBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
 
-	// Give Template texture to quad
-	glUniform1i(tex_loc[0], m_texture[0]);
+	glGenFramebuffers(1, &frameBuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, frameBuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
 
-	// Give Template texture to cube
-	glUniform1i(tex_loc[1], m_texture[0]);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		printf("Framebuffer is not complete\n");
 
-	// Give Car texture to car
-	glUniform1i(tex_loc[2], m_texture[1]);
+	glViewport(0, 0, width, height);
+}
 
-	// Give Car texture to wheel
-	for (int i = 0; i < 4; i++)
-		glUniform1i(tex_loc[3 + i], m_texture[1]);
+// Frees our framebuffer, so it can be made again at another size
+void deleteFrameBuffer()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &frameBuffer);
+	glDeleteRenderbuffers(1, &colorBuffer);
+
+	frameBuffer = 0;
+	colorBuffer = 0;
+}
+
+// This creates the folder, only if it does
+// not already exist
+void makeDirectory(const char* path)
+{
+#ifdef _WIN32
+	CreateDirectoryA(path, NULL);
+#else
+	mkdir(path, 0755);
+#endif
+}
+
+// Gets the image that was rendered (the CPU tracer already wrote
+// it into pixels), and saves it as a PNG called fileName
+void saveFrame(unsigned char* pixels, const char* fileName)
+{
+	double stageStart = getTime();
 
-	// Give Cat texture to cat
-	glUniform1i(tex_loc[7], m_texture[2]);
+	// get the image that was rendered
+	// We use BGR format, because BMP images use BGR
+	if (!useCpuBackend)
+		glReadPixels(0, 0, width, height, GL_BGR, GL_UNSIGNED_BYTE, pixels);
 
-	// Give Dog texture to dog
-	glUniform1i(tex_loc[8], m_texture[3]);
+	frameTimes.readback = getTime() - stageStart;
+	stageStart = getTime();
 
-	// skybox texture
-	glUniform1i(tex_loc[9], m_texture[4]);
+	// Convert to FreeImage format & save to file
+	FIBITMAP* image = FreeImage_ConvertFromRawBits(pixels, width, height, 3 * width, 24, 0xFF0000, 0x00FF00, 0x0000FF, false);
+	FreeImage_Save(FIF_PNG, image, fileName, 0);
+	FreeImage_Unload(image);
 
-	// set ray tracing properties to default values
-	for (int i = 0; i < MAX_MESHES; i++)
+	frameTimes.encode = getTime() - stageStart;
+}
+
+// Renders one frame at the given time, with either backend
+void renderFrame(float time, unsigned char* pixels)
+{
+	if (useCpuBackend)
+		renderSceneCPU(time, pixels);
+	else
+		renderScene(time);
+}
+
+// Renders benchmarkTimes at every one of benchmarkResolutions, and writes
+// how long each stage of every frame took to benchmark.json. The frames are
+// saved in benchmarkFrames, so they can be checked against other builds
+void runBenchmark()
+{
+	makeDirectory("benchmarkFrames");
+
+	FILE* json = fopen("benchmark.json", "w");
+
+	if (json == nullptr)
 	{
-		meshes[i].boolUseEffects = 1;
-		meshes[i].reflectionLevel = 2;
+		printf("Can't write benchmark.json\n");
+		return;
 	}
 
-	// Change properties based on individual meshes
+	int numTimes = sizeof(benchmarkTimes) / sizeof(benchmarkTimes[0]);
+	int numResolutions = sizeof(benchmarkResolutions) / sizeof(benchmarkResolutions[0]);
 
-	// sky
-	meshes[9].boolUseEffects = 0;
-	meshes[9].reflectionLevel = 0;
+	fprintf(json, "{\n");
+	fprintf(json, "\t\"backend\": \"%s\",\n", useCpuBackend ? "cpu" : "gpu");
 
-	// animals
-	meshes[7].reflectionLevel = 0; // cat
-	meshes[8].reflectionLevel = 0; // dog
+	if (useCpuBackend)
+		fprintf(json, "\t\"threads\": %d,\n", cpuThreadCount());
+	else
+		fprintf(json, "\t\"renderer\": \"%s\",\n", (const char*)glGetString(GL_RENDERER));
 
-	// car wheels will probably only reflect ground
-	for (int i = 3; i < 7; i++)
-		meshes[i].reflectionLevel = 1;
+	fprintf(json, "\t\"frames\": [\n");
 
-// By default, this should be 0. By setting it to 1, you disable
-// lighting and relfection, then it's easier to change the scene,
-// for adding objects, changing animaitons, etc
-#define DEBUG_RAYTRACE 0
+	printf("\n%10s %8s %12s %12s %12s %12s %12s\n", "resolution", "time", "transform", "trace", "readback", "encode", "total");
 
-#if DEBUG_RAYTRACE
-	
-	// Disable all lighting and reflection
-	for (int i = 0; i < MAX_MESHES; i++)
+	char fileName[100];
+
+	// The GPU time of each pass, at each resolution, for the end of the JSON
+	std::vector<PassStats> transformStats;
+	std::vector<PassStats> traceStats;
+
+	for (int r = 0; r < numResolutions; r++)
 	{
-		meshes[i].boolUseEffects = 0;
-		meshes[i].reflectionLevel = 0;
+		width = benchmarkResolutions[r][0];
+		height = benchmarkResolutions[r][1];
+
+		if (!useCpuBackend)
+		{
+			deleteFrameBuffer();
+			createFrameBuffer();
+		}
+
+		unsigned char* pixels = new unsigned char[3 * width * height];
+
+		// The first frame at each size is not timed. The driver may
+		// still be compiling shaders, or allocating memory for it.
+		// It is at a time between the first two, not at one of them,
+		// or the first timed frame would have the same matrices, and
+		// findDirtyInstances would find no instances to transform
+		renderFrame((benchmarkTimes[0] + benchmarkTimes[1]) / 2, pixels);
+
+		// the GPU times of the untimed frame are thrown away
+		if (!useCpuBackend)
+		{
+			glFinish();
+			finishPassTimers();
+			gpuTransformTimes.clear();
+			gpuTraceTimes.clear();
+		}
+
+		FrameTimes total = {};
+
+		for (int i = 0; i < numTimes; i++)
+		{
+			renderFrame(benchmarkTimes[i], pixels);
+
+			sprintf(fileName, "benchmarkFrames/%dx%d_%d.png", width, height, i);
+			saveFrame(pixels, fileName);
+
+			FrameTimes& t = frameTimes;
+			double frameTotal = t.transform + t.trace + t.readback + t.encode;
+
+			total.transform += t.transform;
+			total.trace += t.trace;
+			total.readback += t.readback;
+			total.encode += t.encode;
+
+			printf("%4dx%-5d %8.2f %12.6f %12.6f %12.6f %12.6f %12.6f\n",
+				width, height, benchmarkTimes[i], t.transform, t.trace, t.readback, t.encode, frameTotal);
+
+			bool last = (r == numResolutions - 1) && (i == numTimes - 1);
+
+			fprintf(json, "\t\t{ \"width\": %d, \"height\": %d, \"time\": %.3f, "
+				"\"transform\": %.6f, \"trace\": %.6f, \"readback\": %.6f, \"encode\": %.6f, \"total\": %.6f }%s\n",
+				width, height, benchmarkTimes[i], t.transform, t.trace, t.readback, t.encode, frameTotal, last ? "" : ",");
+		}
+
+		printf("%4dx%-5d %8s %12.6f %12.6f %12.6f %12.6f %12.6f\n\n",
+			width, height, "average",
+			total.transform / numTimes, total.trace / numTimes, total.readback / numTimes, total.encode / numTimes,
+			(total.transform + total.trace + total.readback + total.encode) / numTimes);
+
+		if (!useCpuBackend)
+		{
+			glFinish();
+			finishPassTimers();
+			printPassTimers();
+			printf("\n");
+
+			transformStats.push_back(getPassStats(gpuTransformTimes));
+			traceStats.push_back(getPassStats(gpuTraceTimes));
+		}
+
+		delete[] pixels;
 	}
-#endif
 
-	for (int i = 0; i < MAX_MESHES; i++)
+	if (useCpuBackend)
 	{
-		OptimizeMesh(&meshes[i], i);
+		fprintf(json, "\t]\n");
 	}
 
-	int totalTri = 0;
-	int biggestMesh = 0;
-	
-	for (int i = 0; i < MAX_MESHES; i++)
+	else
 	{
-		int n = meshes[i].numTriangles;
+		fprintf(json, "\t],\n");
+		fprintf(json, "\t\"gpuPasses\": [\n");
 
-		if (biggestMesh < n)
-			biggestMesh = n;
+		for (int r = 0; r < numResolutions; r++)
+		{
+			PassStats& t = transformStats[r];
+			PassStats& d = traceStats[r];
+
+			fprintf(json, "\t\t{ \"width\": %d, \"height\": %d, "
+				"\"transform\": { \"frames\": %d, \"min\": %.6f, \"avg\": %.6f, \"p99\": %.6f }, "
+				"\"trace\": { \"frames\": %d, \"min\": %.6f, \"avg\": %.6f, \"p99\": %.6f } }%s\n",
+				benchmarkResolutions[r][0], benchmarkResolutions[r][1],
+				t.frames, t.min, t.avg, t.p99, d.frames, d.min, d.avg, d.p99,
+				r == numResolutions - 1 ? "" : ",");
+		}
 
-		totalTri += n;
+		fprintf(json, "\t]\n");
 	}
 
-	printf("\n");
-	printf("Num Meshes: %d\n", MAX_MESHES);
-	printf("Max Triangles Per Mesh: %d\n", biggestMesh);
-	printf("Total triangles in scene: %d\n", totalTri);
-	printf("Lev1: %d\n", numMeshesLev1);
-	printf("Lev2: %d\n", numMeshesLev2);
-
-	// This sends our OBJ data to the Compute Shader
-	// This data will be constant, and it will never be modified
-	glGenBuffers(1, &triangleObjToComp);
-	glBindBuffer(GL_UNIFORM_BUFFER, triangleObjToComp);
-	glBufferData(GL_UNIFORM_BUFFER, triangleObjToCompSize, meshes, GL_STATIC_DRAW); // static because CPU won't touch it
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	fprintf(json, "}\n");
+	fclose(json);
 
-	// This sends our OBJ data to the Fragment Shader
-	// Some of this data will not be modified, like the number
-	// of triangles per mesh, and the color of each mesh, but
-	// the vertices will be modified and overwritten by the 
-	// compute shader, then send the modifications to the fragment shader
-	glGenBuffers(1, &trianglesCompToFrag);
-	glBindBuffer(GL_UNIFORM_BUFFER, trianglesCompToFrag);
-	glBufferData(GL_UNIFORM_BUFFER, trianglesCompToFragSize, meshes, GL_STATIC_DRAW); // static because CPU won't touch it
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	printf("Benchmark results written to benchmark.json\n");
+}
 
-	glGenBuffers(1, &lightToFrag);
-	glBindBuffer(GL_UNIFORM_BUFFER, lightToFrag);
-	glBufferData(GL_UNIFORM_BUFFER, lightToFrag, nullptr, GL_DYNAMIC_DRAW); // static because CPU won't touch it
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+// Prints how long each step of the startup took, and writes it to
+// startup.json, see StartupProfile.h. This runs once, after the first
+// frame, or before the benchmark starts
+void reportStartupProfile()
+{
+	PrintStartupProfile();
+
+	if (WriteStartupProfile("startup.json"))
+		printf("Startup profile written to startup.json\n\n");
+	else
+		printf("Can't write startup.json\n\n");
 }
 
-void window_size_callback(GLFWwindow* window, int w, int h)
+// After the program is over, cleanup your data!
+void cleanup()
 {
-	width = w;
-	height = h;
-	glViewport(0, 0, width, height);
+	if (useCpuBackend)
+		return;
+
+	glDeleteShader(vertex_shader);
+	glDeleteShader(fragment_shader);
+	glDeleteProgram(draw_program);
+
+	// The per-frame buffers, and the fences of the frames in flight
+	deleteRingBuffer(matrixRing);
+	deleteRingBuffer(dirtyRing);
+	deleteRingBuffer(lightRing);
+	deleteRingBuffer(tlasNodeRing);
+	deleteRingBuffer(tlasInstanceRing);
+
+	for (int i = 0; i < FRAMES_IN_FLIGHT; i++)
+	{
+		if (ringFences[i] != nullptr)
+			glDeleteSync(ringFences[i]);
+
+		ringFences[i] = nullptr;
+	}
+
+	// Frees up our framebuffer, if we made one
+	deleteFrameBuffer();
+
+#ifdef HEADLESS_RENDER
+	// Frees up the EGL context
+	eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	eglDestroyContext(eglDisplay, eglContext);
+	eglTerminate(eglDisplay);
+#else
+	// Frees up GLFW memory
+	glfwTerminate();
+#endif
 }
 
 int main(int argc, char **argv)
 {
-	// Initializes the GLFW library
-	glfwInit();
+	// I finally made a boolean for this
+	// because I got tired of commenting
+	// and uncommenting the code to export
+	// the frames and video files
+	bool saveVideo = true;
+
+	// --cpu renders with the CPU tracer instead of OpenGL
+	// --benchmark times a fixed set of frames, instead of making the video
+	// --quantize packs the UVs, normals, and colors into fewer bytes
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--cpu") == 0)
+			useCpuBackend = true;
+
+		if (strcmp(argv[i], "--benchmark") == 0)
+			benchmarkMode = true;
+
+		if (strcmp(argv[i], "--quantize") == 0)
+			quantizeAttributes = true;
+	}
 
-	// Creates a window given (width, height, title, monitorPtr, windowPtr).
-	// Don't worry about the last two, as they have to do with controlling which monitor to display on and having a reference to other windows. Leaving them as nullptr is fine.
-	window = glfwCreateWindow(width, height, "", nullptr, nullptr);
+	if (useCpuBackend)
+	{
+		// No window and no OpenGL context
+		initCPU();
+	}
 
-	// This allows us to resize the window when we want to
-	glfwSetWindowSizeCallback(window, window_size_callback);
+	else
+	{
+		double start = getTime();
+
+#ifdef HEADLESS_RENDER
+		// Make an OpenGL context with no window. There is no
+		// swap chain, so nothing will wait for vsync
+		if (!createHeadlessContext())
+			return 1;
+#else
+		// Initializes the GLFW library
+		glfwInit();
+
+		// Creates a window given (width, height, title, monitorPtr, windowPtr).
+		// Don't worry about the last two, as they have to do with controlling which monitor to display on and having a reference to other windows. Leaving them as nullptr is fine.
+		window = glfwCreateWindow(width, height, "", nullptr, nullptr);
+
+		// This allows us to resize the window when we want to
+		glfwSetWindowSizeCallback(window, window_size_callback);
+
+		// Makes the OpenGL context current for the created window.
+		glfwMakeContextCurrent(window);
+
+		// Sets the number of screen updates to wait before swapping the buffers.
+		// When we export a video, we don't wait for vsync at all, so the
+		// frames are rendered as fast as the ray tracer can go
+		glfwSwapInterval(saveVideo ? 0 : 1);
+#endif
 
-	// Makes the OpenGL context current for the created window.
-	glfwMakeContextCurrent(window);
+		AddStartupPhase("create OpenGL context", start, 0);
 
-	// Sets the number of screen updates to wait before swapping the buffers.
-	glfwSwapInterval(1);
+		// Initializes most things needed before the main loop
+		if (!init())
+		{
+			cleanup();
+			return 1;
+		}
 
-	// Initializes most things needed before the main loop
-	init();
+#ifdef HEADLESS_RENDER
+		// Render into our own framebuffer, instead of a window
+		createFrameBuffer();
+#endif
+	}
+
+	if (benchmarkMode)
+	{
+		reportStartupProfile();
+		runBenchmark();
+		cleanup();
+		return 0;
+	}
 
 	// Make the BYTE array, factor of 3 because it's RGB.
 	// This will hold each screenshot
 	unsigned char* pixels = new unsigned char[3 * width * height];
 
+	// Rows of 3-byte pixels are not always a multiple of 4 bytes
+	if (!useCpuBackend)
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
 	// Create a place for fileName
 	char* fileName = (char*)malloc(100);
 
-	// I finally made a boolean for this
-	// because I got tired of commenting
-	// and uncommenting the code to export
-	// the frames and video files
-	bool saveVideo = true;
-
 	if (saveVideo)
 	{
 		// This creates the folder, only if it does
 		// not already exist, called "exportedFrames"
-		CreateDirectoryA("exportedFrames", NULL);
+		makeDirectory("exportedFrames");
 	}
 
 	// record what time the rendering started
-	clock_t start = clock();
+	double start = getTime();
 
 	// continue rendering until the desired
 	// number of frames are hit
 
 	while (totalFrame != maxFrames)
 	{
-		// Call the render function.
-		renderScene();
+		double frameStart = getTime();
+
+		// Call the render function. The CPU
+		// tracer writes straight into pixels
+		renderFrame(beginFrame(), pixels);
+
+		// The startup is over when the first frame is done, so
+		// we wait for the GPU to finish it, only this one time
+		if (totalFrame == 1)
+		{
+			if (!useCpuBackend)
+				glFinish();
+
+			AddStartupPhase("first frame", frameStart, 0);
+			reportStartupProfile();
+		}
 
-		// Swaps the back buffer to the front buffer
-		// Remember, you're rendering to the back buffer, then once rendering is complete, you're moving the back buffer to the front so it can be displayed.
-		glfwSwapBuffers(window);
+#ifndef HEADLESS_RENDER
+		if (!useCpuBackend)
+		{
+			// Swaps the back buffer to the front buffer
+			// Remember, you're rendering to the back buffer, then once rendering is complete, you're moving the back buffer to the front so it can be displayed.
+			glfwSwapBuffers(window);
 
-		// Checks to see if any events are pending and then processes them.
-		glfwPollEvents();
+			// Checks to see if any events are pending and then processes them.
+			glfwPollEvents();
+		}
+#endif
 
 		// If you don't want to save screenshots,
 		// then use "continue" to restart the loop
 		if (!saveVideo)
 			continue;
 
-		// get the image that was rendered
-		// We use BGR format, because BMP images use BGR
-		glReadPixels(0, 0, width, height, GL_BGR, GL_UNSIGNED_BYTE, pixels);
-
 		// make the name of the current file
 		sprintf(fileName, "exportedFrames/%d.png", totalFrame);
 
-		// Convert to FreeImage format & save to file
-		FIBITMAP* image = FreeImage_ConvertFromRawBits(pixels, width, height, 3 * width, 24, 0xFF0000, 0x00FF00, 0x0000FF, false);
-		FreeImage_Save(FIF_PNG, image, fileName, 0);
-		FreeImage_Unload(image);
+		saveFrame(pixels, fileName);
 	}
 
-	// record what time the rendering ended
-	clock_t end = clock();
+	// wait for the last frame, if we were not reading it back
+	if (!useCpuBackend)
+	{
+		glFinish();
+		finishPassTimers();
+	}
 
-	// how many seconds it took to render
-	float totalTime = (float)(end - start) / 1000.0f;
+	// how many seconds it took to render. This is wall time,
+	// clock() measures CPU time on some platforms
+	float totalTime = (float)(getTime() - start);
 
 	// print statistics
-	printf("\n%d frames rendered in %f seconds, %f FPS\n\n", maxFrames, totalTime, (float)maxFrames / totalTime);
+	printf("\n%d frames rendered in %f seconds, %f FPS\n", maxFrames, totalTime, (float)maxFrames / totalTime);
+
+	// One primary ray per pixel, on both backends, so these can be compared.
+	// Only the CPU tracer can count the shadow and reflection rays too
+	printf("%f million primary rays per second\n", (double)width * height * maxFrames / totalTime / 1000000.0);
+
+	if (useCpuBackend)
+	{
+		printf("%f million rays per second (primary, shadow, and reflection)\n", totalCpuRays / totalTime / 1000000.0);
+		printf("%f million triangle tests per second\n", totalCpuTriangleTests / totalTime / 1000000.0);
+	}
+
+	printf("\n");
+
+	// How the GPU time of a frame is split between the passes
+	if (!useCpuBackend)
+	{
+		printPassTimers();
+		printf("\n");
+	}
 
-	// After the program is over, cleanup your data!
-	glDeleteShader(vertex_shader);
-	glDeleteShader(fragment_shader);
-	glDeleteProgram(draw_program);
 	delete[] pixels;
 
-	// Frees up GLFW memory
-	glfwTerminate();
+	cleanup();
 	
 	// make space for a command
 	char* command = (char*)malloc(1000);